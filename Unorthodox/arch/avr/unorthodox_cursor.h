@@ -12,16 +12,28 @@
 
 class Cursor  {
 public:
-	virtual bool apply(byte b);                  // apply the next sequence byte to the cursor
+	virtual bool apply(byte b) = 0;              // apply the next sequence byte to the cursor
 	virtual bool revert() { return false; }      // revert one sequence byte
 	virtual bool valid() { return false; }       // test if cursor is in accept state
 	virtual bool accept() { return false; }      // test if cursor is in accept state
-	virtual int  symbol();         // the accepted symbol token
+	virtual int  symbol() = 0;     // the accepted symbol token
 	virtual int  predict() { return 0; }         // how many bytes are predictable?
 	virtual byte emit() { return 0; }            // return the next predictable byte
 	// virtual byte seek(int index) { return 0; }
 	// virtual byte state() { return 0; }
-	virtual void reset();
+	virtual void reset() = 0;
+
+	// drive the cursor through its predictable bytes, echoing them to the stream (if any).
+	// this is tab-completion: the caller has applied what was typed, and we finish it off.
+	// returns the number of bytes written, which may still leave the cursor short of accept.
+	int complete(Stream * out) {
+		int n = predict();
+		for(int i=0; i<n; i++) {
+			byte b = emit();
+			if(out) out->write(b);
+		}
+		return n;
+	}
 };
 
 /*
@@ -42,7 +54,7 @@ public:
 		reset();
 	}
 	~BufferCursor() {
-		delete this->buffer;
+		delete[] this->buffer;
 	}
 	// reset
 	void reset() {
@@ -73,6 +85,135 @@ public:
 	}
 };
 
+/*
+  RingPage is a read-only view of some bytes still sitting in a ByteRing, so a received frame
+  can be handed to anything that reads Pages without copying it out first. The view wraps
+  around the end of the ring just as the data does. It's only good until the bytes are released.
+ */
+class RingPage : public ReadPage {
+private:
+	ByteRing * ring;
+	byte start;
+public:
+	word length;
+
+	RingPage(ByteRing * ring, byte start, word length) {
+		this->ring = ring;
+		this->start = start;
+		this->length = length;
+	}
+	void set(byte start, word length) {
+		this->start = start;
+		this->length = length;
+	}
+	void read(word index, void * v, int count) {
+		byte p = start + index;
+		for(int i=0; i<count; i++) ((byte *)v)[i] = ring->at(p++);
+	}
+	Page * clone(int offset) { return new RingPage(ring, start + offset, length - offset); }
+};
+
+/*
+  RingCursor is a BufferCursor that keeps its bytes in a ByteRing instead of its own array, and
+  collects them into frames ending with a delimiter byte. (like a newline)
+
+  Normally an interrupt fills the ring and the main loop polls for complete frames, then runs
+  them through whatever cursors it likes straight out of the ring - or reads them as a Page -
+  before releasing them. Receiving carries on into the rest of the ring all the while.
+
+    RingCursor line(&rx, '\n');
+    ...
+    if(line.poll()) {
+      if(line.feed(&commands)) dispatch(commands.symbol());
+      line.release();
+    }
+
+  apply() pushes a byte into the ring, for when the bytes come from somewhere other than an ISR.
+  That makes the main loop the ring's producer, and a ByteRing can only have one - so never
+  apply() to a ring that an interrupt is also pushing into. A frame that fills the whole ring without a delimiter can never complete, so it is thrown away
+  and counted in 'overruns'.
+ */
+class RingCursor : public Cursor {
+private:
+	ByteRing * ring;
+	byte delimiter;
+	byte scanned;   // bytes already checked for the delimiter
+	bool framed;    // is there a complete frame at the front?
+	byte length;    // length of that frame, not counting the delimiter
+	RingPage view;
+public:
+	word overruns;
+
+	// constructor
+	RingCursor(ByteRing * ring, byte delimiter) : view(ring, 0, 0) {
+		this->ring = ring;
+		this->delimiter = delimiter;
+		overruns = 0;
+		reset();
+	}
+	// reset - forget about any frame we found, but leave the ring alone
+	void reset() {
+		scanned = 0;
+		framed = false;
+		length = 0;
+	}
+	// look for a complete frame. true once there's one waiting.
+	bool poll() {
+		if(framed) return true;
+		byte available = ring->count();
+		while(scanned < available) {
+			if(ring->peek(scanned) == delimiter) {
+				length = scanned;
+				framed = true;
+				return true;
+			}
+			scanned++;
+		}
+		if(scanned >= ring->capacity()) {
+			// the ring is full of one unterminated frame. make room.
+			ring->skip(scanned);
+			scanned = 0;
+			overruns++;
+		}
+		return false;
+	}
+	// valid state
+	bool valid() { return true; }
+	// accepting state - is a frame waiting?
+	bool accept() { return framed; }
+	// accepting symbol - the frame length
+	int symbol() { return framed ? length : 0; }
+	// apply next serial byte (from somewhere other than the ISR)
+	bool apply(byte b) {
+		ring->push(b);
+		poll();
+		return true;
+	}
+
+	// the waiting frame, as a page
+	RingPage * frame() {
+		view.set(ring->front(), framed ? length : 0);
+		return &view;
+	}
+	byte frame_length() { return framed ? length : 0; }
+
+	// run the frame through another cursor. true if it accepted the whole thing.
+	bool feed(Cursor * cursor) {
+		cursor->reset();
+		if(!framed) return false;
+		for(byte i=0; i<length; i++) {
+			if(!cursor->apply(ring->peek(i))) return false;
+		}
+		return cursor->accept();
+	}
+
+	// done with the frame. hand its bytes (and the delimiter) back to the ring.
+	void release() {
+		if(framed) ring->skip(length + 1);
+		reset();
+	}
+};
+
 /*
   PageCursor will accept bytes so long as they match the contents of a MemoryPage.
   This is equivalent to a "constant string".
@@ -104,18 +245,17 @@ public:
 	// content prediction works fine when you are really a memory block
 	int predict() { return cursor_valid ? (count-index) : 0; }
 	byte emit() { 
-		if(!cursor_valid) return 0;
-		byte b = page->read_byte(index++);
-		if(index>=count) cursor_valid = 0;
-		return b; 
+		if(!cursor_valid || index>=count) return 0;
+		// emitting the last byte leaves us in accept state, just as applying it would
+		return page->read_byte(index++);
 	}
 	// accepting symbol
 	int symbol() { return accept() ? 1 : 0; }
 	// apply next serial byte
 	bool apply(byte b) {
 		if(cursor_valid) {
-			// test next page byte
-			if(page->read_byte(index++)!=b) {
+			// test next page byte (anything past the end is a mismatch)
+			if(index>=count || page->read_byte(index++)!=b) {
 				// not the same
 				cursor_valid = false;
 			}
@@ -129,9 +269,10 @@ public:
   is the integer value of the number.
  */
 class NumberCursor : public Cursor  {
-private:
+public:
 	static const int SIGNED = 0x01;
 	static const int UNSIGNED = 0x00;
+private:
 	word state;
 	word index;
 	word mode;
@@ -161,8 +302,8 @@ public:
 	}
 	// valid state
 	bool valid() { return state!=2; }
-	// accepting state
-	bool accept() { return state==1; }
+	// accepting state (once we've had at least one digit)
+	bool accept() { return (state==1) && symbol_accept; }
 	// accepting symbol
 	int symbol() { return symbol_negative ? -symbol_word : symbol_word; }
 	// apply next serial byte
@@ -183,6 +324,7 @@ public:
 			} else {
 				state = 2;
 			}
+			break;
 		case 1: // parse next byte, expect digit only
 			if((digit>=0) && (digit<=9)) {
 				symbol_word = symbol_word*10 + digit;
@@ -197,6 +339,216 @@ public:
 	}
 };
 
+/*
+  LongNumberCursor is the 32-bit big brother of NumberCursor, with a few more formats:
+
+    SIGNED      - allow a leading '+' or '-'
+    HEX_PREFIX  - allow a '0x' prefix, after which the digits are hex. (plain decimal still works)
+                  Hex values are taken as a 32-bit pattern, so 0xFFFFFFFF is -1.
+    FIXED_POINT - allow a decimal point. value() is then scaled up by 10^scale, so with a scale of 3,
+                  "12.5" gives 12500. Fractional digits beyond the scale are ignored. (truncated)
+
+  Out-of-range numbers - decimals past the range of a long, or hex with more than 32 bits - saturate
+  to the largest (or smallest) long and set overflow(), rather than wrapping around. The overflow checks compare against constants before each digit is added, so
+  there is no division anywhere - which matters on an AVR, where a 32-bit divide takes hundreds
+  of cycles and the multiply-by-ten is only shifts and adds.
+
+  value() is the full 32-bit result, symbol() just the low int of it.
+ */
+class LongNumberCursor : public Cursor  {
+public:
+	static const byte UNSIGNED = 0x00;
+	static const byte SIGNED = 0x01;
+	static const byte HEX_PREFIX = 0x02;
+	static const byte FIXED_POINT = 0x04;
+private:
+	// parse states
+	static const byte START = 0;    // expect sign or digit
+	static const byte SIGN = 1;     // had a sign, expect digit
+	static const byte ZERO = 2;     // a leading zero, which might be the start of 0x
+	static const byte DIGITS = 3;   // decimal digits
+	static const byte HEXSTART = 4; // had 0x, expect hex digit
+	static const byte HEXDIGITS = 5;
+	static const byte POINT = 6;    // had a decimal point, expect digit
+	static const byte FRACTION = 7; // fractional digits
+	static const byte FAILED = 99;
+
+	byte mode;
+	byte scale;
+	byte state;
+	byte fraction;   // fractional digits taken so far
+	bool negative;
+	bool overflowed;
+	unsigned long magnitude;
+
+	// the largest magnitude we can hold, for the sign we have
+	unsigned long limit() { return negative ? 0x80000000UL : 0x7FFFFFFFUL; }
+
+	// magnitude*10 + digit, saturating
+	void push_decimal(byte digit) {
+		if(overflowed) return;
+		// 214748364 is the largest value that can be multiplied by ten without passing the limit
+		if( (magnitude > 214748364UL) || ((magnitude == 214748364UL) && (digit > (negative ? 8 : 7))) ) {
+			overflowed = true;
+			magnitude = limit();
+		} else {
+			magnitude = (magnitude << 3) + (magnitude << 1) + digit;
+		}
+	}
+
+	// magnitude*16 + digit. Past 32 bits it saturates like a decimal does, since the all-ones
+	// pattern would read back as -1.
+	void push_hex(byte digit) {
+		if(overflowed) return;
+		if(magnitude > 0x0FFFFFFFUL) {
+			overflowed = true;
+			magnitude = limit();
+		} else {
+			magnitude = (magnitude << 4) | digit;
+		}
+	}
+
+	static int hex_digit(byte b) {
+		if((b >= '0') && (b <= '9')) return b - '0';
+		if((b >= 'a') && (b <= 'f')) return b - 'a' + 10;
+		if((b >= 'A') && (b <= 'F')) return b - 'A' + 10;
+		return -1;
+	}
+
+	// the decimal part of the state machine, shared by several states
+	void decimal(byte b) {
+		byte digit = b - '0';
+		if(digit <= 9) {
+			push_decimal(digit);
+			state = DIGITS;
+		} else if((b=='.') && (mode & FIXED_POINT)) {
+			state = POINT;
+		} else {
+			state = FAILED;
+		}
+	}
+public:
+	// constructor
+	LongNumberCursor() {
+		this->mode = UNSIGNED;
+		this->scale = 0;
+		reset();
+	}
+	LongNumberCursor(byte mode) {
+		this->mode = mode;
+		this->scale = 0;
+		reset();
+	}
+	LongNumberCursor(byte mode, byte scale) {
+		this->mode = mode;
+		this->scale = scale;
+		reset();
+	}
+	// reset
+	void reset() {
+		state = START;
+		fraction = 0;
+		negative = false;
+		overflowed = false;
+		magnitude = 0;
+	}
+	// valid state
+	bool valid() { return state!=FAILED; }
+	// accepting state
+	bool accept() { return (state==ZERO) || (state==DIGITS) || (state==HEXDIGITS) || (state==FRACTION); }
+	// did the number saturate? (which includes scaling it up, for fixed point)
+	bool overflow() {
+		bool over;
+		scaled(&over);
+		return over;
+	}
+	// accepting symbol
+	int symbol() { return (int)value(); }
+
+	// the magnitude, scaled up for the fractional digits we didn't get
+	unsigned long scaled(bool * over) {
+		unsigned long m = magnitude;
+		*over = overflowed;
+		if( (mode & FIXED_POINT) && (state != HEXDIGITS) ) {
+			for(byte f = fraction; (f < scale) && !*over; f++) {
+				if(m > 214748364UL) { *over = true; } else { m = (m << 3) + (m << 1); }
+			}
+			if(m > limit()) *over = true;
+			if(*over) m = limit();
+		}
+		return m;
+	}
+
+	// the parsed value, as a long (scaled, if this is a fixed point cursor)
+	long value() {
+		bool over;
+		unsigned long m = scaled(&over);
+		// (the 32-bit casts keep this right where long is wider, too)
+		if(negative) return (long)(int32_t)(0UL - m);
+		return (long)(int32_t)m;
+	}
+
+	// apply next serial byte
+	bool apply(byte b) {
+		switch(state) {
+			case START: // expect sign or digit
+				if((mode & SIGNED) && ((b=='-') || (b=='+'))) {
+					negative = (b=='-');
+					state = SIGN;
+					break;
+				}
+				// fall through - no sign
+			case SIGN: // expect the first digit
+				if((b=='0') && (mode & HEX_PREFIX)) {
+					state = ZERO;
+				} else if(b=='.') {
+					state = FAILED; // need a digit first
+				} else {
+					decimal(b);
+				}
+				break;
+			case ZERO: // a leading zero. is this hex?
+				if((b=='x') || (b=='X')) {
+					state = HEXSTART;
+				} else {
+					decimal(b);
+				}
+				break;
+			case DIGITS:
+				decimal(b);
+				break;
+			case HEXSTART:
+			case HEXDIGITS: {
+				int digit = hex_digit(b);
+				if(digit < 0) {
+					state = FAILED;
+				} else {
+					push_hex(digit);
+					state = HEXDIGITS;
+				}
+				break;
+			}
+			case POINT:
+			case FRACTION: {
+				byte digit = b - '0';
+				if(digit <= 9) {
+					// keep the digits the scale has room for, and ignore the rest
+					if(fraction < scale) {
+						push_decimal(digit);
+						fraction++;
+					}
+					state = FRACTION;
+				} else {
+					state = FAILED;
+				}
+				break;
+			}
+			case FAILED: break; // error sink
+		}
+		return valid();
+	}
+};
+
 /*
   PrefixCursor will accept bytes that index into a Prefix Tree. The stored symbol token for the tree is retured as the accept symbol.
  */
@@ -262,6 +614,49 @@ public:
 		return valid();
 	}
 
+	// how many bytes can only go one way from here? (stopping at the first accept state)
+	int predict() {
+		// remember where we are. the walk goes through apply(), so it has to be undone.
+		word s_state = state; word s_index = index; word s_span_end = span_end;
+		word s_symbol = symbol_word; bool s_accept = symbol_accept;
+		bool s_leaf = head_leaf; bool s_span = head_span; bool s_radix = head_radix;
+		word s_count = head_count;
+		// walk forward while there's no choice to be made
+		int n = 0; byte b;
+		while(!symbol_accept && next_unique(&b)) {
+			apply(b); n++;
+		}
+		// put it all back
+		state = s_state; index = s_index; span_end = s_span_end;
+		symbol_word = s_symbol; symbol_accept = s_accept;
+		head_leaf = s_leaf; head_span = s_span; head_radix = s_radix;
+		head_count = s_count;
+		return n;
+	}
+	// apply and return the next predictable byte, or zero if there isn't one
+	byte emit() {
+		byte b;
+		if(symbol_accept || !next_unique(&b)) return 0;
+		apply(b);
+		return b;
+	}
+
+	// is the next byte forced? either we're part-way along a span, or at a prefix table with one entry.
+	bool next_unique(byte * b) {
+		if(state==1) {
+			*b = page->read_byte(index);
+			return true;
+		}
+		if(state==2) {
+			// same radix rule as next_prefix(), but only peeking
+			byte radix = head_span ? page->read_byte(index) : head_count;
+			if(radix!=1) return false;
+			*b = page->read_byte(index + (head_span ? 1 : 0));
+			return true;
+		}
+		return false;
+	}
+
 	void next_node() {
 		// get the node header
 		word node_head = Cardinal::decode_word(page,index);
@@ -293,7 +688,7 @@ public:
 		}
 	}
 
-	int next_span(byte b) {
+	void next_span(byte b) {
 		byte c = page->read_byte(index++);
 		symbol_accept = false;
 		if(b==c) {
@@ -322,7 +717,7 @@ public:
 		}
 	}
 
-	int next_prefix(byte b) {
+	void next_prefix(byte b) {
 		symbol_accept = false;
 		// work out our radix count
 		byte radix;
@@ -359,4 +754,439 @@ public:
 
 };
 
+/*
+  DFACursor runs a table-driven state machine, as compiled from a list of regular expressions by
+  the dfa-compile host tool. (Unorthodox/tools) Every byte costs the same two table reads - the
+  byte's class, then the next state - no matter how complicated the grammar is.
+
+  Table layout, all bytes:
+    [states] [classes] [start] [0]
+    class_map[256]         input byte -> byte class
+    accept[states]         the symbol for each state, or zero if it isn't an accept state
+    next[states*classes]   next state for each state and class. State 0 is the dead state.
+
+  Bytes that no state tells apart share a class, which is what keeps the 'next' table small -
+  a typical command grammar has a few dozen states and a dozen classes.
+
+  Like PrefixCursor it can read the table through any ReadPage, but when given a PROGMEM
+  table it reads flash directly, which saves the virtual page calls.
+ */
+class DFACursor : public Cursor {
+private:
+	ReadPage * page;
+	prog_uchar * table;
+	byte classes;
+	byte start;
+	byte state;
+	word accept_base;
+	word next_base;
+
+	byte read(word index) {
+		return table ? pgm_read_byte_near(table + index) : page->read_byte(index);
+	}
+
+	void load() {
+		byte states = read(0);
+		classes = read(1);
+		start = read(2);
+		accept_base = 4 + 256;
+		next_base = accept_base + states;
+		reset();
+	}
+public:
+	// constructor
+	DFACursor(ReadPage * memory) {
+		page = memory;
+		table = 0;
+		load();
+	}
+	DFACursor(PROGMEM prog_uchar * dfa) {
+		page = 0;
+		table = dfa;
+		load();
+	}
+	// reset
+	void reset() {
+		state = start;
+	}
+	// valid state
+	bool valid() { return state!=0; }
+	// accepting state
+	bool accept() { return read(accept_base + state)!=0; }
+	// accepting symbol
+	int symbol() { return read(accept_base + state); }
+	// apply next serial byte
+	bool apply(byte b) {
+		if(state) {
+			state = read(next_base + state * classes + read(4 + b));
+		}
+		return state!=0;
+	}
+};
+
+/*
+  CursorSet runs several cursors side by side over the same input, such as a command line being
+  matched against each of the commands it might be. Each byte only goes to the cursors that are
+  still valid - the live ones are kept as bits in a word, so a dead cursor costs nothing - and the
+  set as a whole stays valid for as long as any of them does.
+
+  Two answers are kept as the bytes go past:
+    accept_index()  - the first cursor (in the order they were added) accepting right now
+    longest_index() - the cursor which accepted the longest input so far. ('maximal munch')
+  Ties go to the cursor added first, so add the more specific grammars first.
+
+  Up to 16 cursors. The set doesn't own them, and resets them all on reset().
+ */
+class CursorSet : public Cursor {
+public:
+	static const byte MAX_CURSORS = 16;
+private:
+	Cursor * cursor[MAX_CURSORS];
+	byte count;
+	word live;       // cursors that are still valid
+	word accepting;  // cursors in an accept state after the last byte
+	word length;     // bytes applied since reset
+	int  longest;    // cursor with the longest accepted input, or -1
+	word longest_len;
+	int  longest_sym;
+
+	// note the first accepting cursor as the longest match so far
+	void note_longest() {
+		if(accepting) {
+			byte i = 0;
+			while( (accepting & (1<<i))==0 ) i++;
+			longest = i;
+			longest_len = length;
+			longest_sym = cursor[i]->symbol();
+		}
+	}
+public:
+	// constructor
+	CursorSet() {
+		count = 0;
+		reset();
+	}
+	// add another cursor to the set. false if it's full.
+	bool add(Cursor * c) {
+		if(count >= MAX_CURSORS) return false;
+		cursor[count] = c;
+		word bit = 1 << count;
+		count++;
+		c->reset();
+		if(c->valid()) live |= bit;
+		if(c->accept()) accepting |= bit;
+		note_longest();
+		return true;
+	}
+	// reset
+	void reset() {
+		live = 0;
+		accepting = 0;
+		length = 0;
+		longest = -1;
+		longest_len = 0;
+		longest_sym = 0;
+		for(byte i=0; i<count; i++) {
+			cursor[i]->reset();
+			if(cursor[i]->valid()) live |= 1 << i;
+			if(cursor[i]->accept()) accepting |= 1 << i;
+		}
+		note_longest();
+	}
+	// valid state - is anybody still alive?
+	bool valid() { return live!=0; }
+	// accepting state
+	bool accept() { return accepting!=0; }
+	// the symbol of the first accepting cursor
+	int symbol() { 
+		int i = accept_index();
+		return (i<0) ? 0 : cursor[i]->symbol();
+	}
+	// apply next serial byte to the live cursors only
+	bool apply(byte b) {
+		word m = live;
+		word bit = 1;
+		byte i = 0;
+		accepting = 0;
+		length++;
+		while(m) {
+			if(m & 1) {
+				Cursor * c = cursor[i];
+				if(c->apply(b)) {
+					if(c->accept()) accepting |= bit;
+				} else {
+					// dead. don't bother it again until reset.
+					live &= ~bit;
+				}
+			}
+			m >>= 1;
+			bit <<= 1;
+			i++;
+		}
+		note_longest();
+		return live!=0;
+	}
+
+	// which cursors are still alive, or accepting, as bit masks
+	word live_mask() { return live; }
+	word accept_mask() { return accepting; }
+
+	// the first cursor accepting right now, or -1
+	int accept_index() {
+		if(accepting==0) return -1;
+		byte i = 0;
+		while( (accepting & (1<<i))==0 ) i++;
+		return i;
+	}
+
+	// the cursor that accepted the most input, how much, and what symbol it had at that point
+	int longest_index() { return longest; }
+	word longest_length() { return longest_len; }
+	int longest_symbol() { return longest_sym; }
+
+	Cursor * get(byte i) { return cursor[i]; }
+	byte size() { return count; }
+};
+
+/*
+  Cursor combinators, for building a record parser out of smaller cursors:
+
+    SequenceCursor  - parts one after the other
+    RepeatCursor    - the same part several times, with an optional separator byte
+    OptionalCursor  - a part that may be missing
+    CaptureCursor   - copies a part's symbol into an int field as it's accepted
+    (alternation is just a CursorSet - it's already a Cursor)
+
+  None of them allocate anything, and each byte only goes to the one part it belongs to, so a
+  record is decoded in a single pass as it arrives. For example "T:23 H:45 V:-12,33,40" :
+
+    struct Telemetry { int t; int h; int v[3]; } rec;
+    NumberCursor t_num, h_num, v_num(NumberCursor::SIGNED);
+    CaptureCursor t_cap(&t_num, &rec.t), h_cap(&h_num, &rec.h);
+    RepeatCursor v_list(&v_num, ',', 1, 3, rec.v);
+    SequenceCursor record;
+    record.add(&t_tag); record.add(&t_cap);      // t_tag is a PageCursor over "T:", and so on
+    record.add(&h_tag); record.add(&h_cap);
+    record.add(&v_tag); record.add(&v_list);
+
+  Matching is greedy and never backs up: a part keeps every byte it will take, and the next part
+  only gets a look-in when the current one rejects a byte while it was in an accept state. That
+  is enough for the usual 'fields with delimiters' records, but it does mean "ledon" will never
+  match the sequence "led" then "on" if the first part could also take "ledon".
+
+  Each position needs its own cursor instance, since the parts are reset as they're entered.
+ */
+class SequenceCursor : public Cursor {
+public:
+	static const byte MAX_PARTS = 16;
+private:
+	Cursor * part[MAX_PARTS];
+	byte count;
+	byte index;      // the part currently taking bytes
+	bool live;
+	int  token;
+public:
+	// constructor
+	SequenceCursor() {
+		count = 0;
+		token = 1;
+		reset();
+	}
+	SequenceCursor(int symbol) {
+		count = 0;
+		token = symbol;
+		reset();
+	}
+	// append another part. false if it's full.
+	bool add(Cursor * c) {
+		if(count >= MAX_PARTS) return false;
+		part[count++] = c;
+		c->reset();
+		return true;
+	}
+	// reset
+	void reset() {
+		index = 0;
+		live = true;
+		for(byte i=0; i<count; i++) part[i]->reset();
+	}
+	// valid state
+	bool valid() { return live; }
+	// accepting state - the current part accepts, and everything after it can be empty
+	bool accept() {
+		if(!live) return false;
+		for(byte i=index; i<count; i++) {
+			if(!part[i]->accept()) return false;
+		}
+		return true;
+	}
+	// accepting symbol
+	int symbol() { return accept() ? token : 0; }
+	// apply next serial byte
+	bool apply(byte b) {
+		if(!live) return false;
+		while(index < count) {
+			Cursor * c = part[index];
+			bool was = c->accept();
+			if(c->apply(b)) return true;
+			// rejected. if the part was already complete then the byte belongs to the next one.
+			if(!was) break;
+			if(++index < count) part[index]->reset();
+		}
+		live = false;
+		return false;
+	}
+	// which part are we up to?
+	byte position() { return index; }
+};
+
+/*
+  RepeatCursor matches the inner cursor between min and max times. (a max of zero means no limit)
+  With a separator byte the items must be separated by it ("12,33,40"), otherwise each item
+  simply ends where the inner cursor stops accepting bytes.
+
+  If given an int array, each item's symbol is stored in it as the item is accepted - there must
+  be room for max items.
+ */
+class RepeatCursor : public Cursor {
+private:
+	Cursor * inner;
+	int * fields;
+	byte separator;
+	byte min;
+	byte max;
+	byte items;      // completed items before the current one
+	bool started;    // has the current item had any bytes?
+	bool live;
+public:
+	// constructor
+	RepeatCursor(Cursor * inner, byte separator, byte min, byte max) {
+		this->inner = inner;
+		this->fields = 0;
+		this->separator = separator;
+		this->min = min;
+		this->max = max;
+		reset();
+	}
+	RepeatCursor(Cursor * inner, byte separator, byte min, byte max, int * fields) {
+		this->inner = inner;
+		this->fields = fields;
+		this->separator = separator;
+		this->min = min;
+		this->max = max;
+		reset();
+	}
+	// reset
+	void reset() {
+		items = 0;
+		started = false;
+		live = true;
+		inner->reset();
+	}
+	// valid state
+	bool valid() { return live; }
+	// accepting state
+	bool accept() {
+		if(!live) return false;
+		if(!started) return (items==0) && (min==0);
+		return inner->accept() && (items+1 >= min);
+	}
+	// accepting symbol - the number of items
+	int symbol() { return accept() ? (started ? items+1 : 0) : 0; }
+	// apply next serial byte
+	bool apply(byte b) {
+		if(!live) return false;
+		bool was = started && inner->accept();
+		if(item(b)) return true;
+		// the inner cursor is done with us. is this the start of the next item?
+		if(was && (max==0 || items+1 < max) && items < 255) {
+			items++;
+			started = false;
+			inner->reset();
+			if(separator) {
+				if(b==separator) return true;
+			} else {
+				if(item(b)) return true;
+			}
+		}
+		live = false;
+		return false;
+	}
+	// how many items have been completed, not counting the current one
+	byte completed() { return items; }
+private:
+	// apply a byte to the current item, capturing it if it accepts
+	bool item(byte b) {
+		if(!inner->apply(b)) return false;
+		started = true;
+		if(fields && inner->accept()) fields[items] = inner->symbol();
+		return true;
+	}
+};
+
+/*
+  OptionalCursor accepts either nothing, or whatever the inner cursor accepts.
+ */
+class OptionalCursor : public Cursor {
+private:
+	Cursor * inner;
+	bool started;
+public:
+	// constructor
+	OptionalCursor(Cursor * inner) {
+		this->inner = inner;
+		reset();
+	}
+	// reset
+	void reset() {
+		started = false;
+		inner->reset();
+	}
+	// valid state
+	bool valid() { return !started || inner->valid(); }
+	// accepting state
+	bool accept() { return !started || inner->accept(); }
+	// accepting symbol (zero if we skipped it)
+	int symbol() { return started ? inner->symbol() : 0; }
+	// apply next serial byte
+	bool apply(byte b) {
+		started = true;
+		return inner->apply(b);
+	}
+};
+
+/*
+  CaptureCursor passes everything through to the inner cursor, and whenever the inner cursor
+  accepts it copies the symbol into an int field. The field is left alone on reset, so clear
+  the record first if you need to know which fields were present.
+ */
+class CaptureCursor : public Cursor {
+private:
+	Cursor * inner;
+	int * field;
+public:
+	// constructor
+	CaptureCursor(Cursor * inner, int * field) {
+		this->inner = inner;
+		this->field = field;
+	}
+	// reset
+	void reset() { inner->reset(); }
+	// valid state
+	bool valid() { return inner->valid(); }
+	// accepting state
+	bool accept() { return inner->accept(); }
+	// accepting symbol
+	int symbol() { return inner->symbol(); }
+	// apply next serial byte
+	bool apply(byte b) {
+		if(!inner->apply(b)) return false;
+		if(inner->accept()) *field = inner->symbol();
+		return true;
+	}
+	// prediction goes straight through
+	int predict() { return inner->predict(); }
+	byte emit() { return inner->emit(); }
+};
+
 #endif
\ No newline at end of file
@@ -18,17 +18,162 @@ class Device {
 // if the SPI library is inclided, then add some device types
 #ifdef _SPI_H_INCLUDED
 
+/*
+  SPITransfer describes one chip-selected SPI transaction for the SPIEngine: which chip, the bytes to
+  send (or zero to send zeroes), where to put the bytes received (or zero to drop them), and an
+  optional function to call when it's done. tx and rx can be the same buffer.
+
+  The descriptor belongs to the engine from submit() until 'busy' goes false, so don't touch it
+  (or its buffers) in between.
+ */
+class SPITransfer : public HALNode {
+  public:
+    volatile byte * cs_port;
+    byte cs_mask;
+    byte * tx;
+    byte * rx;
+    word count;
+    void (*done)(SPITransfer * t); // called from the SPI interrupt, so keep it short
+    void * context;                // for the done function's use
+    volatile bool busy;
+    
+    // constructor
+    SPITransfer() {
+      next = 0;
+      cs_port = 0;
+      cs_mask = 0;
+      tx = 0;
+      rx = 0;
+      count = 0;
+      done = 0;
+      context = 0;
+      busy = false;
+    }
+    // look up the port register and bit for a chip select pin, so it can be written directly
+    void set_chip(int pin) {
+      cs_port = portOutputRegister(digitalPinToPort(pin));
+      cs_mask = digitalPinToBitMask(pin);
+    }
+    void set(byte * tx, byte * rx, word count) {
+      this->tx = tx;
+      this->rx = rx;
+      this->count = count;
+    }
+};
+
+/*
+  SPIEngine runs queued SPITransfers from the SPI interrupt, one byte per interrupt, so the CPU
+  is free while a display is being pushed or an ethernet buffer read. Transfers run in the order
+  they were submitted, and submit() is safe from other interrupts (and from 'done' functions).
+
+  The SPI library doesn't claim the SPI interrupt, so the sketch has to hand it over:
+
+    SPIEngine spi_engine;
+    ISR(SPI_STC_vect) { spi_engine.isr(); }
+
+  The interrupt is only enabled while the engine has work, because SPI.transfer() polls for the
+  same flag. So plain SPI.transfer() calls (including the SPIDevice ones) are fine whenever the
+  engine is idle(), but must not overlap with queued transfers.
+ */
+class SPIEngine {
+  private:
+    HALQueue pending;
+    SPITransfer * volatile current;
+    word index;
+    
+    // select the next transfer and send its first byte. interrupts must be off.
+    void start_next() {
+      while(true) {
+        SPITransfer * t = (SPITransfer *)pending.dequeue();
+        current = t;
+        if(!t) {
+          // nothing left - give the interrupt back
+          SPCR &= ~(1<<SPIE);
+          return;
+        }
+        if(t->count) {
+          index = 0;
+          *t->cs_port &= ~t->cs_mask;
+          SPCR |= (1<<SPIE);
+          SPDR = t->tx ? t->tx[0] : 0;
+          return;
+        }
+        // nothing to send
+        finish(t);
+      }
+    }
+    
+    void finish(SPITransfer * t) {
+      t->busy = false;
+      if(t->done) t->done(t);
+    }
+    
+  public:
+    // constructor
+    SPIEngine() {
+      current = 0;
+      index = 0;
+    }
+    
+    // queue a transfer. false if it's still busy from last time.
+    bool submit(SPITransfer * t) {
+      if(t->busy) return false;
+      t->busy = true;
+      t->next = 0;
+      pending.enqueue(t);
+      // if the engine is idle, start it
+      byte sreg = SREG;
+      cli();
+      if(!current) start_next();
+      SREG = sreg;
+      return true;
+    }
+    
+    bool idle() { return current == 0; }
+    
+    // wait for one transfer to finish
+    void wait(SPITransfer * t) {
+      while(t->busy) { }
+    }
+    
+    // the SPI interrupt handler
+    void isr() {
+      SPITransfer * t = current;
+      if(!t) return;
+      byte b = SPDR;
+      if(t->rx) t->rx[index] = b;
+      index++;
+      if(index < t->count) {
+        SPDR = t->tx ? t->tx[index] : 0;
+        return;
+      }
+      // finished this one. deselect the chip and move on.
+      *t->cs_port |= t->cs_mask;
+      finish(t);
+      start_next();
+    }
+};
+
 /*
   SPIDevice
 */
 class SPIDevice : public Device {
   protected:
     int chip_select;
+    volatile byte * cs_port; // chip select port register and bit, looked up on first use
+    byte cs_mask;
   public:
     // constructor
     SPIDevice() {
       // set up the slave select line
       chip_select = 0;
+      cs_port = 0;
+    }
+    
+    // fill in a transfer descriptor for this device, for queueing on an SPIEngine
+    void prepare(SPITransfer * t, byte * tx, byte * rx, word count) {
+      t->set_chip(chip_select);
+      t->set(tx, rx, count);
     }
   protected:
   
@@ -47,6 +192,23 @@ class SPIDevice : public Device {
       for(int i=0; i<count; i++) transfer_word(&w[i]);
     }
 
+    // fast chip select, with direct port writes and no settling delays. for devices which
+    // don't need them (most don't, at these clock rates)
+    // (the pin is only known once the subclass constructor has set chip_select, so the port
+    // is looked up by whichever of these gets called first)
+    void select() {
+      if(!cs_port) cs_lookup();
+      *cs_port &= ~cs_mask;
+    }
+    void deselect() {
+      if(!cs_port) cs_lookup();
+      *cs_port |= cs_mask;
+    }
+    void cs_lookup() {
+      cs_port = portOutputRegister(digitalPinToPort(chip_select));
+      cs_mask = digitalPinToBitMask(chip_select);
+    }
+
     void transfer_bytes(byte * b, int count) {
       digitalWrite(chip_select, HIGH); // should have been this way to start with...
       delayMicroseconds(10); // not sure how long since the last one, so wait a moment
@@ -6,6 +6,278 @@
 #ifndef UNORTHODOX_DRIVERS_I2C_H
 #define UNORTHODOX_DRIVERS_I2C_H
 
+// does the chip have a TWI (I2C) unit?
+#ifdef TWCR
+
+/*
+  TWITransaction describes one I2C transaction for the TWIEngine: some bytes written to a device,
+  then (after a repeated start) some bytes read back from it. Either part can be empty. Like an
+  SPITransfer, it belongs to the engine from submit() until 'busy' goes false.
+
+  set_read() and set_write() fill it in for the usual register accesses, using the little command
+  buffer inside the transaction, so nothing else has to stay allocated.
+ */
+class TWITransaction : public HALNode {
+public:
+	byte address;               // 7 bit device address
+	byte * tx;
+	byte tx_count;
+	byte * rx;
+	byte rx_count;
+	void (*done)(TWITransaction * t); // called from the TWI interrupt, so keep it short
+	void * context;
+	volatile bool busy;
+	byte error;                 // zero, or the TWI status it failed on (0xFF for a bus error)
+	byte command[2];
+
+	// constructor
+	TWITransaction() {
+		next = 0;
+		address = 0;
+		tx = 0;
+		tx_count = 0;
+		rx = 0;
+		rx_count = 0;
+		done = 0;
+		context = 0;
+		busy = false;
+		error = 0;
+	}
+	void set(byte address, byte * tx, byte tx_count, byte * rx, byte rx_count) {
+		this->address = address;
+		this->tx = tx;
+		this->tx_count = tx_count;
+		this->rx = rx;
+		this->rx_count = rx_count;
+	}
+	// read 'count' registers, starting from 'reg'
+	void set_read(byte address, byte reg, byte * rx, byte count) {
+		command[0] = reg;
+		set(address, command, 1, rx, count);
+	}
+	// write one register
+	void set_write(byte address, byte reg, byte value) {
+		command[0] = reg;
+		command[1] = value;
+		set(address, command, 2, 0, 0);
+	}
+	// a big-endian register pair
+	static int word_at(const byte * b) { return (b[0] << 8) | b[1]; }
+};
+
+/*
+  TWIEngine runs queued TWITransactions from the TWI interrupt, one bus event per interrupt, so
+  the main loop never waits on the bus. Transactions run in the order they were submitted, and
+  submit() is safe from other interrupts (and from 'done' functions).
+
+  It drives the TWI registers itself, so it can't be used alongside the Wire library - which also
+  wants the TWI interrupt. The sketch hands the interrupt over:
+
+    TWIEngine twi;
+    ISR(TWI_vect) { twi.isr(); }
+    setup: twi.start(400000);
+
+  At 400kHz a 14 byte register read takes about half a millisecond of bus time, and almost none
+  of the CPU's.
+
+  The interrupt never waits for a STOP to go out. When another transaction is queued, the STOP
+  and the next START are asked for together, and the hardware sends them back to back. When
+  there isn't, the STOP finishes by itself a bit time or so later. If submit() wakes the engine
+  up inside that window, it waits for the STOP there - at most a few microseconds, unless a
+  slave is stretching the clock.
+ */
+class TWIEngine {
+private:
+	HALQueue pending;
+	TWITransaction * volatile current;
+	byte index;
+	bool reading;
+	// TWI status codes (TWSR, prescaler bits masked)
+	static const byte START        = 0x08;
+	static const byte REP_START    = 0x10;
+	static const byte MT_SLA_ACK   = 0x18;
+	static const byte MT_DATA_ACK  = 0x28;
+	static const byte MR_SLA_ACK   = 0x40;
+	static const byte MR_DATA_ACK  = 0x50;
+	static const byte MR_DATA_NACK = 0x58;
+	static const byte BUS_ERROR    = 0x00;
+
+	// carry on, with the interrupt
+	static void go(byte bits) { TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE) | bits; }
+
+	// take the next transaction off the queue, and set up for it
+	TWITransaction * next_transaction() {
+		TWITransaction * t = (TWITransaction *)pending.dequeue();
+		current = t;
+		if(t) {
+			index = 0;
+			reading = (t->tx_count == 0) && t->rx_count;
+		}
+		return t;
+	}
+
+	// start the next transaction on an idle bus. interrupts must be off.
+	void start_next() {
+		if(!next_transaction()) {
+			// nothing left - give the interrupt back
+			TWCR = (1<<TWEN);
+			return;
+		}
+		// the last transaction's STOP may still be going out
+		while(TWCR & (1<<TWSTO)) { }
+		go(1<<TWSTA);
+	}
+
+	// end the transaction on the bus, with the next one (if any) right behind it
+	void stop_next() {
+		if(!next_transaction()) {
+			// just the STOP, without the interrupt. it goes out by itself.
+			TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
+			return;
+		}
+		go((1<<TWSTO) | (1<<TWSTA));
+	}
+
+	void finish(TWITransaction * t, byte error) {
+		t->error = error;
+		t->busy = false;
+		if(t->done) t->done(t);
+	}
+
+public:
+	// constructor
+	TWIEngine() {
+		current = 0;
+		index = 0;
+		reading = false;
+	}
+
+	// set the bus speed, and turn on the pull-ups
+	void start(unsigned long frequency) {
+		digitalWrite(SDA, HIGH);
+		digitalWrite(SCL, HIGH);
+		TWSR = 0; // prescaler 1
+		TWBR = ((F_CPU / frequency) - 16) / 2;
+		TWCR = (1<<TWEN);
+	}
+
+	// queue a transaction. false if it's still busy from last time.
+	bool submit(TWITransaction * t) {
+		if(t->busy) return false;
+		t->busy = true;
+		t->error = 0;
+		t->next = 0;
+		pending.enqueue(t);
+		// if the engine is idle, start it
+		byte sreg = SREG;
+		cli();
+		if(!current) start_next();
+		SREG = sreg;
+		return true;
+	}
+
+	bool idle() { return current == 0; }
+
+	// wait for one transaction to finish
+	void wait(TWITransaction * t) {
+		while(t->busy) { }
+	}
+
+	// the TWI interrupt handler
+	void isr() {
+		TWITransaction * t = current;
+		if(!t) { TWCR = (1<<TWEN); return; }
+		byte status = TWSR & 0xF8;
+		switch(status) {
+			case START:
+			case REP_START:
+				index = 0;
+				TWDR = (t->address << 1) | (reading ? 1 : 0);
+				go(0);
+				return;
+			case MT_SLA_ACK:
+			case MT_DATA_ACK:
+				if(index < t->tx_count) {
+					TWDR = t->tx[index++];
+					go(0);
+					return;
+				}
+				if(t->rx_count) {
+					// turn the bus around with a repeated start
+					reading = true;
+					go(1<<TWSTA);
+					return;
+				}
+				finish(t, 0);
+				break;
+			case MR_SLA_ACK:
+				// acknowledge every byte but the last
+				go((t->rx_count > 1) ? (1<<TWEA) : 0);
+				return;
+			case MR_DATA_ACK:
+				t->rx[index++] = TWDR;
+				go((index + 1 < t->rx_count) ? (1<<TWEA) : 0);
+				return;
+			case MR_DATA_NACK:
+				t->rx[index++] = TWDR;
+				finish(t, 0);
+				break;
+			case BUS_ERROR:
+				// a bus error. this STOP only resets the TWI unit - nothing goes on the bus, and
+				// it's done at once, so the next transaction can start from idle.
+				TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
+				finish(t, 0xFF);
+				start_next();
+				return;
+			default:
+				// not acknowledged, or arbitration lost
+				finish(t, status);
+				break;
+		}
+		stop_next();
+	}
+};
+
+/*
+  A whole MPU6050 sample - accelerometer, temperature and gyro - as one 14 byte burst read
+  for the TWIEngine. For sampling an IMU at 1kHz without the main loop waiting on the bus:
+
+    MPU6050Reading imu;
+    void sample(int dt) { if(!imu.busy) twi.submit(&imu); }
+    ... tasks.every(&sample_task, 1);
+    ... if(!imu.busy) { imu.gyro_vector(g); ... }
+ */
+class MPU6050Reading : public TWITransaction {
+public:
+	byte data[14];
+
+	// constructor
+	MPU6050Reading() {
+		set_read(0x68, 0x3B, data, 14);
+	}
+	void accel_vector(int * v) { for(byte i=0; i<3; i++) v[i] = word_at(data + i*2); }
+	void temp_vector(int * v) { v[0] = word_at(data + 6); }
+	void gyro_vector(int * v) { for(byte i=0; i<3; i++) v[i] = word_at(data + 8 + i*2); }
+};
+
+/*
+  An HMC5883L field vector as one 6 byte burst read, for the TWIEngine.
+  (in register order, which is X, Z, Y)
+ */
+class HMC5883LReading : public TWITransaction {
+public:
+	byte data[6];
+
+	// constructor
+	HMC5883LReading() {
+		set_read(0x1E, 0x03, data, 6);
+	}
+	void get_vector(int * v) { for(byte i=0; i<3; i++) v[i] = word_at(data + i*2); }
+};
+
+#endif
+
+
 // is the Wire library included?
 #ifdef TwoWire_h
 
@@ -27,27 +299,18 @@ public:
 	}
 
 	bool read_packet(byte device, byte address, byte * buffer, byte length) {
-		// send phase
+		// send phase - the register address, then a repeated start rather than a stop
 		Wire.beginTransmission(device);
 		Wire.write(address);
-		Wire.endTransmission();
-		// recieve phase
-		Wire.beginTransmission(device);
-		Wire.requestFrom(device, (uint8_t)length);
+		if(Wire.endTransmission(false)!=0) return false;
+		// recieve phase. (requestFrom does the whole transaction, stop included)
+		byte r = Wire.requestFrom(device, (uint8_t)length);
 		// how many did we get?
-		byte r = Wire.available();
-		if(r <= length) {
-			for(byte i = 0; i < r; i++) { 
-				buffer[i] = Wire.read(); 
-				// Serial.print("."); Serial.print(buffer[i]);
-			}
-		} else {
-			// consume unexpected bytes
-			for(byte i = 0; i < length; i++) { Wire.read(); } //  { Serial.print("!"); Serial.print(Wire.read()); }
+		for(byte i = 0; i < r; i++) { 
+			byte b = Wire.read();
+			if(i < length) buffer[i] = b; // (consume unexpected bytes)
 		}
-		Wire.endTransmission();
 		// if(r < length) { Serial.print(" packet too short! "); Serial.print(r); }
-		// if(r > length) { Serial.print(" packet too long! "); Serial.print(r); }
 		return (r==length);
 	}
 
@@ -149,6 +412,18 @@ public:
 			return false;
 		}
 	}
+	// accelerometer, temperature and gyro all at once, since they're consecutive registers. one
+	// 14 byte transaction instead of three, and the readings all come from the same sample.
+	bool motion_vector(int * accel, int * temp, int * gyro) {
+		byte buffer[14];
+		if(!read_packet(I2C_MPU6050, 0x3B, buffer, 14)) return false;
+		for(byte i=0; i<3; i++) {
+			accel[i] = (buffer[i*2] << 8) | buffer[i*2+1];
+			gyro[i] = (buffer[8+i*2] << 8) | buffer[8+i*2+1];
+		}
+		temp[0] = (buffer[6] << 8) | buffer[7];
+		return true;
+	}
 	bool get_ident() {
 		byte buffer[3];
 		// [todo: might not be necessary - try just dumping directly into the vector]
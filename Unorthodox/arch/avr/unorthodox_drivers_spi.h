@@ -90,6 +90,76 @@ public:
 };
 
 
+/*
+ENC28J60Batch is a list of ENC28J60 register operations to run in one go. Running the list is
+bank-aware: it only switches banks when it has to, and if the order doesn't matter it runs all
+the operations in the current bank first and then each other bank in turn, so every bank is
+visited at most once. Reads put their result back in the op's data byte.
+
+    ENC28J60Op ops[8];
+    ENC28J60Batch batch(ops, 8);
+    batch.write_word(ENC28J60::ERXRDPT, ptr);
+    byte count = batch.read(ENC28J60::EPKTCNT);
+    eth.run(&batch, true);
+    ... batch.result(count)
+*/
+struct ENC28J60Op {
+  byte code;
+  byte address;
+  byte data;
+};
+
+class ENC28J60Batch {
+  public:
+    // SPI opcodes. (the same as ENC28J60::OP_*)
+    static const byte READ       = 0x00;
+    static const byte WRITE      = 0x40;
+    static const byte BIT_SET    = 0x80;
+    static const byte BIT_CLEAR  = 0xA0;
+    ENC28J60Op * ops;
+    byte count;
+    byte max;
+    
+    // constructor
+    ENC28J60Batch(ENC28J60Op * storage, byte max) {
+      ops = storage;
+      this->max = max;
+      count = 0;
+    }
+    void clear() { count = 0; }
+    // add an op. returns its index, or 0xFF if the batch is full.
+    byte add(byte code, byte address, byte data) {
+      if(count >= max) return 0xFF;
+      ENC28J60Op * o = &ops[count];
+      o->code = code;
+      o->address = address;
+      o->data = data;
+      return count++;
+    }
+    byte read(byte address) { return add(READ, address, 0); }
+    byte write(byte address, byte data) { return add(WRITE, address, data); }
+    // low byte first, as the chip wants
+    byte write_word(byte address, word data) {
+      add(WRITE, address, data & 0xFF);
+      return add(WRITE, address+1, data >> 8);
+    }
+    byte bit_set(byte address, byte mask) { return add(BIT_SET, address, mask); }
+    byte bit_clear(byte address, byte mask) { return add(BIT_CLEAR, address, mask); }
+    byte result(byte index) { return ops[index].data; }
+};
+
+/*
+  A received packet, as handed over by ENC28J60::rx_interrupt(). It's just where the packet is
+  in the chip's buffer - the packet itself stays there until it's released.
+*/
+class ENC28J60Packet : public HALNode {
+  public:
+    word start;         // first byte of the frame, in the chip buffer
+    word length;        // frame length, without the CRC
+    word status;        // receive status vector bits 16-31 (bit 7 = received ok)
+    word next_packet;   // where the packet after this one starts
+};
+
 /*
 ENC28J60 Ethernet Interface
 */
@@ -319,10 +389,22 @@ class ENC28J60 : public SPIDevice {
     // 
     byte _current_bank;
     word _next_packet_ptr;  
+    word _read_ptr;       // where ERDPT is now, as far as we know (0xFFFF if we don't)
+    word _rx_start;       // the current packet's first byte, in the chip buffer
+    word _tx_length;      // frame bytes written since tx_begin()
+    // interrupt driven receive
+    volatile byte _busy;  // main loop SPI frames in progress. the interrupt mustn't touch the bus
+    volatile bool _rx_deferred;
+    byte _rx_held;        // packets handed out, and not released yet
+    HALQueue * _rx_packets;
+    HALQueue * _rx_free;
 
   public:
     byte device_revision;
     byte mac_address[6];
+    // the packet rx_begin() found
+    word rx_length;       // frame length, without the CRC
+    word rx_status;       // receive status vector bits 16-31 (bit 7 = received ok)
   
     // constructor
     ENC28J60(int pin) {
@@ -330,6 +412,17 @@ class ENC28J60 : public SPIDevice {
       chip_select = pin;
       // no current bank
       _current_bank = 0xFF;
+      _next_packet_ptr = RXSTART_INIT;
+      _read_ptr = 0xFFFF;
+      _rx_start = 0;
+      _tx_length = 0;
+      _busy = 0;
+      _rx_deferred = false;
+      _rx_held = 0;
+      _rx_packets = 0;
+      _rx_free = 0;
+      rx_length = 0;
+      rx_status = 0;
       device_revision = 0;
       // partially random MAC address - made from common 'local' OUI prefix and random NIC number
       mac_address[0] = 0x42; // the bits MUST be xxxxxx10 
@@ -358,8 +451,8 @@ class ENC28J60 : public SPIDevice {
     
     void sleep() {
       write_op(OP_BITCLR_REGISTER, ECON1, ECON1_RXEN);
-      if(!wait_ready(ESTAT, ESTAT_RXBUSY, 10)) return;
-      if(!wait_ready(ECON1, ECON1_TXRTS, 10)) return;
+      if(!wait_clear(ESTAT, ESTAT_RXBUSY, 10)) return;
+      if(!wait_clear(ECON1, ECON1_TXRTS, 10)) return;
       write_op(OP_BITSET_REGISTER, ECON2, ECON2_VRPS);
       write_op(OP_BITSET_REGISTER, ECON2, ECON2_PWRSV);
     }
@@ -383,6 +476,165 @@ class ENC28J60 : public SPIDevice {
       write_op(OP_BITSET_REGISTER, ECON2, ECON2_PKTDEC); 
     }
     
+    /*
+      Zero-copy receive. rx_begin() reads the next packet's header and returns its length (or zero
+      if there isn't one), then the packet can be read in place through rx_read() or an
+      ENC28J60Page, and rx_end() hands the space back to the chip.
+      
+        while(eth.rx_begin()) {
+          ENC28J60Page packet(&eth);
+          ... packet.read_byte(12) ...
+          eth.rx_end();
+        }
+    */
+    word rx_begin() {
+      if(read_reg_byte(EPKTCNT)==0) return 0;
+      // the 6 byte header: next packet pointer, byte count, status
+      word header[3];
+      rx_read_at(_next_packet_ptr, header, 6);
+      _rx_start = rx_wrap(_next_packet_ptr + 6);
+      _next_packet_ptr = header[0];
+      rx_length = (header[1] > 4) ? header[1] - 4 : 0;
+      rx_status = header[2];
+      return rx_length ? rx_length : 1; // (a runt still has to be ended)
+    }
+    // read bytes from the current packet
+    void rx_read(word offset, void * v, word count) {
+      rx_read_at(rx_wrap(_rx_start + offset), v, count);
+    }
+    // release the current packet
+    void rx_end() {
+      // the read pointer has to be odd - silicon errata 14
+      word ptr = (_next_packet_ptr == RXSTART_INIT) ? RXSTOP_INIT : _next_packet_ptr - 1;
+      rx_accept(ptr);
+    }
+    
+    /*
+      Transmit. tx_begin() starts a frame in the chip's transmit buffer, tx_write() streams bytes
+      onto the end of it, and tx_send() sends it. Headers whose contents aren't known until the end
+      (lengths, checksums) can be written as blanks and filled in later with tx_write_at(), so the
+      frame never has to exist in RAM.
+      
+      Offsets are from the start of the frame (the destination MAC address).
+    */
+    // false if the last frame still hasn't gone
+    bool tx_begin() {
+      if(!wait_clear(ECON1, ECON1_TXRTS, 10)) return false;
+      write_reg_word(EWRPT, TXSTART_INIT);
+      byte control = 0x00; // per-packet control byte - use the MACON3 defaults
+      write_buffer(&control, 1);
+      _tx_length = 0;
+      return true;
+    }
+    void tx_write(const void * v, word count) {
+      write_buffer((byte *)v, count);
+      _tx_length += count;
+    }
+    // overwrite part of the frame so far, without moving the end
+    void tx_write_at(word offset, const void * v, word count) {
+      write_reg_word(EWRPT, TXSTART_INIT + 1 + offset);
+      write_buffer((byte *)v, count);
+      write_reg_word(EWRPT, TXSTART_INIT + 1 + _tx_length);
+    }
+    word tx_length() { return _tx_length; }
+    
+    // read part of the frame so far back out of the transmit buffer
+    void tx_read(word offset, void * v, word count) {
+      write_reg_word(ERDPT, TXSTART_INIT + 1 + offset);
+      read_buffer((byte *)v, count);
+    }
+    
+    // the internet checksum of part of the frame so far, worked out by the chip's DMA engine while
+    // we wait. this is the final (complemented) value, to be written high byte first.
+    // false if the engine didn't finish in time (the checksum is then left alone).
+    bool tx_checksum(word offset, word count, word * checksum) {
+      if(count==0) { *checksum = 0xFFFF; return true; }
+      word start = TXSTART_INIT + 1 + offset;
+      ENC28J60Op ops[5];
+      ENC28J60Batch batch(ops, 5);
+      batch.write_word(EDMAST, start);
+      batch.write_word(EDMAND, start + count - 1);
+      batch.bit_set(ECON1, ECON1_CSUMEN | ECON1_DMAST);
+      run(&batch, false);
+      bool done = wait_clear(ECON1, ECON1_DMAST, 10);
+      // (if it timed out, stop the engine as well - with CSUMEN clear it would go on as a copy)
+      write_op(OP_BITCLR_REGISTER, ECON1, done ? ECON1_CSUMEN : ECON1_CSUMEN | ECON1_DMAST);
+      if(!done) return false;
+      *checksum = read_reg_word(EDMACS);
+      return true;
+    }
+    
+    // send the frame. (the chip pads short frames and adds the CRC)
+    void tx_send() {
+      ENC28J60Op ops[8];
+      ENC28J60Batch batch(ops, 8);
+      // reset the transmit logic first - silicon errata 12
+      batch.bit_set(ECON1, ECON1_TXRST);
+      batch.bit_clear(ECON1, ECON1_TXRST);
+      batch.bit_clear(EIR, EIR_TXERIF | EIR_TXIF);
+      batch.write_word(ETXST, TXSTART_INIT);
+      batch.write_word(ETXND, TXSTART_INIT + _tx_length);
+      batch.bit_set(ECON1, ECON1_TXRTS);
+      run(&batch, false);
+    }
+    bool tx_busy() {
+      return read_reg_byte(ECON1) & ECON1_TXRTS;
+    }
+    
+    /*
+      Interrupt driven receive. Wire the chip's INT pin to an external interrupt, hand the driver
+      a pool of descriptors, and call rx_interrupt() from the interrupt. It reads the headers of
+      any new packets and puts a descriptor for each on the 'packets' queue, so the main loop
+      never has to poll the chip to find out if anything has arrived:
+      
+        ENC28J60Packet pool[4];
+        HALQueue packets, spare;
+        void eth_interrupt() { eth.rx_interrupt(); }
+        
+        setup: for(...) spare.enqueue(&pool[i]);
+               eth.rx_queue(&packets, &spare);
+               attachInterrupt(1, eth_interrupt, FALLING);  // INT1 is pin 2 on the Leonardo
+        loop:  ENC28J60Packet * p = (ENC28J60Packet *)packets.dequeue();
+               if(p) { eth.rx_select(p); ... ENC28J60Page ... ; eth.rx_release(p); }
+      
+      Packets must be released in the order they came, and rx_begin() can't be used as well.
+      
+      The interrupt won't use the bus while the driver is in the middle of an SPI frame - it leaves
+      the work to be done as soon as that frame ends. Between frames it puts the bank and read
+      pointer back as it found them. It can't know about other devices on the bus, though, so mask
+      the interrupt around any transfers to those.
+      
+      INT stays asserted for as long as the chip holds any packets, so the interrupt turns it off
+      while packets are out. New arrivals are picked up whenever one is released, and INT is
+      turned on again once they all have been.
+    */
+    void rx_queue(HALQueue * packets, HALQueue * free) {
+      _rx_packets = packets;
+      _rx_free = free;
+    }
+    // call this from the INT interrupt
+    void rx_interrupt() {
+      if(!_rx_packets) return;
+      if(_busy) { _rx_deferred = true; return; }
+      rx_collect();
+    }
+    // make a packet the current one, for rx_read() and ENC28J60Page
+    void rx_select(ENC28J60Packet * p) {
+      _rx_start = p->start;
+      rx_length = p->length;
+      rx_status = p->status;
+    }
+    // give a packet's space back to the chip, and its descriptor back to the pool
+    void rx_release(ENC28J60Packet * p) {
+      _busy++;
+      rx_accept((p->next_packet == RXSTART_INIT) ? RXSTOP_INIT : p->next_packet - 1);
+      _rx_held--;
+      _rx_free->enqueue(p);
+      _busy--;
+      // see if anything else came in meanwhile
+      rx_collect();
+    }
+    
     byte read_reg_byte(byte address) {
       switch_bank(address);
       return read_op(OP_READ_REGISTER, address);
@@ -395,6 +647,7 @@ class ENC28J60 : public SPIDevice {
     }
     
     void write_reg_byte(byte address, byte data) {
+      if((address & 0xFE)==ERDPT) _read_ptr = 0xFFFF;
       switch_bank(address);
       write_op(OP_WRITE_REGISTER, address, data);
     }
@@ -405,13 +658,14 @@ class ENC28J60 : public SPIDevice {
       switch_bank(address);
       write_op(OP_WRITE_REGISTER, address, data & 0xFF);
       write_op(OP_WRITE_REGISTER, address+1, (data >> 8) & 0xFF);
+      if(address==ERDPT) _read_ptr = data;
     }
     
     word read_phy_byte(byte address) {
       write_reg_byte(MIREGADR, address);
       write_reg_byte(MICMD, MICMD_MIIRD);
       // while (read_reg_byte(MISTAT) & MISTAT_BUSY) { }
-      if(!wait_ready(MISTAT, MISTAT_BUSY, 10)) return 0;
+      if(!wait_clear(MISTAT, MISTAT_BUSY, 10)) return 0;
       write_reg_byte(MICMD, 0x00);
       return read_reg_byte(MIRD+1);
     }
@@ -420,28 +674,36 @@ class ENC28J60 : public SPIDevice {
         write_reg_byte(MIREGADR, address);
         write_reg_word(MIWR, data);
         // while (read_reg_byte(MISTAT) & MISTAT_BUSY) { }
-        if(!wait_ready(MISTAT, MISTAT_BUSY, 10)) return;
+        if(!wait_clear(MISTAT, MISTAT_BUSY, 10)) return;
     }
     
     void read_buffer(byte * data, word count) {
-      digitalWrite(chip_select, HIGH); // should have been this way to start with...
-      delayMicroseconds(10); // not sure how long since the last one, so wait a moment
-      digitalWrite(chip_select, LOW); // select the chip, let it know data is coming.
-      delayMicroseconds(4); // give it a moment to prepare
+      _read_ptr = 0xFFFF; // (we don't know where it was set)
+      select();
       SPI.transfer(OP_READ_BUFFER);
-      // SPI.transfer(0);
       while(count-->0) { *data = SPI.transfer(0); data++; } // transfer the data
-      digitalWrite(chip_select, HIGH); // and de-select the chip
+      deselect();
     }
 
     void write_buffer(byte * data, word count) {
-      digitalWrite(chip_select, HIGH); // should have been this way to start with...
-      delayMicroseconds(10); // not sure how long since the last one, so wait a moment
-      digitalWrite(chip_select, LOW); // select the chip, let it know data is coming.
-      delayMicroseconds(4); // give it a moment to prepare
+      select();
       SPI.transfer(OP_WRITE_BUFFER);
       while(count-->0) { SPI.transfer(*data); data++; } // transfer the data
-      digitalWrite(chip_select, HIGH); // and de-select the chip
+      deselect();
+    }
+    
+    // run a batch of register ops. if any_order is set, they're grouped by bank.
+    void run(ENC28J60Batch * batch, bool any_order) {
+      if(!any_order) {
+        for(byte i=0; i<batch->count; i++) run_op(&batch->ops[i]);
+        return;
+      }
+      // the current bank (and the registers in every bank) first, then the others
+      byte first = _current_bank;
+      run_bank(batch, first, true);
+      for(byte bank=0; bank<=0x60; bank+=0x20) {
+        if(bank!=first) run_bank(batch, bank, false);
+      }
     }
     
     
@@ -460,49 +722,155 @@ class ENC28J60 : public SPIDevice {
     }
     
   private:
+    // wrap a receive buffer address around the end of the ring
+    static word rx_wrap(word address) {
+      if(address > RXSTOP_INIT) address -= RXSTOP_INIT + 1 - RXSTART_INIT;
+      return address;
+    }
+    
+    // read from the receive ring. ERDPT is only set when the read doesn't carry on from the last
+    // one, so a cursor reading a packet byte by byte only costs one short SPI frame per byte.
+    // (the chip wraps ERDPT around the ring by itself)
+    void rx_read_at(word address, void * v, word count) {
+      if(address != _read_ptr) write_reg_word(ERDPT, address);
+      select();
+      SPI.transfer(OP_READ_BUFFER);
+      byte * data = (byte *)v;
+      for(word i=0; i<count; i++) data[i] = SPI.transfer(0);
+      deselect();
+      _read_ptr = rx_wrap(address + count);
+    }
+    
+    // wait for any of the bits to be set
     bool wait_ready(byte reg, byte mask, word time) {
-      unsigned long timeout = millis()+time;
-      while (!read_op(OP_READ_REGISTER, reg) & mask) { if(millis()>timeout) return false; }
+      unsigned long start = millis();
+      while ( !(read_reg_byte(reg) & mask) ) { if(millis()-start > time) return false; }
+      return true;
+    }
+    // wait for all of the bits to be clear
+    bool wait_clear(byte reg, byte mask, word time) {
+      unsigned long start = millis();
+      while ( read_reg_byte(reg) & mask ) { if(millis()-start > time) return false; }
       return true;
     }
     
+    // chip select, keeping the interrupt off the bus until the frame is done
+    void select() {
+      _busy++;
+      SPIDevice::select();
+    }
+    void deselect() {
+      SPIDevice::deselect();
+      _busy--;
+      if(_rx_deferred && !_busy) rx_collect();
+    }
+    
+    // read the headers of newly arrived packets, and queue them. this can happen between any two
+    // frames of whatever the main loop was doing, so the bank and read pointer get put back.
+    void rx_collect() {
+      _busy++;
+      _rx_deferred = false;
+      byte bank = _current_bank;
+      word read_ptr = _read_ptr;
+      byte bsel = read_op(OP_READ_REGISTER, ECON1) & (ECON1_BSEL1|ECON1_BSEL0);
+      _current_bank = bsel << 5;
+      word erdpt = read_reg_word(ERDPT);
+      _read_ptr = erdpt;
+      write_op(OP_BITCLR_REGISTER, EIE, EIE_INTIE);
+      byte count = read_reg_byte(EPKTCNT);
+      while(count > _rx_held) {
+        ENC28J60Packet * p = (ENC28J60Packet *)_rx_free->dequeue();
+        if(!p) break; // out of descriptors - the rest wait in the chip
+        word header[3];
+        rx_read_at(_next_packet_ptr, header, 6);
+        p->start = rx_wrap(_next_packet_ptr + 6);
+        p->next_packet = header[0];
+        p->length = (header[1] > 4) ? header[1] - 4 : 0;
+        p->status = header[2];
+        _next_packet_ptr = header[0];
+        _rx_held++;
+        p->next = 0;
+        _rx_packets->enqueue(p);
+      }
+      // put things back
+      if(_read_ptr != erdpt) write_reg_word(ERDPT, erdpt);
+      if(bsel != (_current_bank >> 5)) {
+        write_op(OP_BITCLR_REGISTER, ECON1, ECON1_BSEL1|ECON1_BSEL0);
+        if(bsel) write_op(OP_BITSET_REGISTER, ECON1, bsel);
+      }
+      _current_bank = bank;
+      _read_ptr = read_ptr;
+      // INT can only come back on once the chip isn't holding any packets
+      if(count==0) write_op(OP_BITSET_REGISTER, EIE, EIE_INTIE);
+      _busy--;
+      // (the interrupt may have come in while we were at it)
+      if(_rx_deferred && !_busy) rx_collect();
+    }
+    
+    // registers 0x1B-0x1F appear in every bank
+    static bool common_reg(byte address) { return (address & ADDR_MASK) >= 0x1B; }
+    
+    void run_op(ENC28J60Op * o) {
+      switch_bank(o->address);
+      if(o->code==OP_READ_REGISTER) {
+        o->data = read_op(o->code, o->address);
+      } else {
+        if((o->address & 0xFE)==ERDPT) _read_ptr = 0xFFFF;
+        write_op(o->code, o->address, o->data);
+      }
+    }
+    
+    void run_bank(ENC28J60Batch * batch, byte bank, bool common) {
+      for(byte i=0; i<batch->count; i++) {
+        ENC28J60Op * o = &batch->ops[i];
+        if(common_reg(o->address) ? common : ((o->address & BANK_MASK)==bank)) run_op(o);
+      }
+    }
+    
     void send_reset() {
       write_op(OP_SOFT_RESET, 0, OP_SOFT_RESET);
+      // the reset clears ECON1, so we're in bank 0
+      _current_bank = 0;
+      _read_ptr = 0xFFFF;
+      _next_packet_ptr = RXSTART_INIT;
+      _tx_length = 0;
       delayMicroseconds(2000);
       if(!wait_ready(ESTAT, ESTAT_CLKRDY, 10)) return;
       // clear the buffer memory (for debug reasons)
       write_reg_word(EWRPT, 0);   // Buffer Serial Write Pointer
       byte zeroes[32]; for(int i=0; i<32; i++) zeroes[i]=0;
       for(int i=0; i<256; i++) { write_buffer(zeroes,32); }
-      // _next_packet_ptr = RXSTART_INIT;
-      write_reg_word(ERDPT, RXSTART_INIT);   // Buffer Serial Read Pointer
-      write_reg_word(EWRPT, TXSTART_INIT);   // Buffer Serial Write Pointer
-      write_reg_word(ETXST, TXSTART_INIT);   // TX Buffer Start
-      write_reg_word(ETXND, TXSTOP_INIT);    // TX Buffer Stop
-      write_reg_word(ERXST, RXSTART_INIT);   // RX Buffer Start
-      write_reg_word(ERXND, RXSTOP_INIT);    // RX Buffer Stop
-      write_reg_word(ERXRDPT, RXSTART_INIT);  // RX Read (Lock) Pointer
-      // write_reg_word(ERXWRPT, RXSTART_INIT); // RX Write Pointer - should be reset to RXSTART_INIT
-      enable_broadcast(); // change to add ERXFCON_BCEN recommended by epam
-      write_reg_word(EPMM0, 0x303f);
-      write_reg_word(EPMCS, 0xf7f9);
-      write_reg_byte(MACON1, MACON1_MARXEN | MACON1_TXPAUS | MACON1_RXPAUS);
-      write_reg_byte(MACON2, 0x00);
-      write_op(OP_BITSET_REGISTER, MACON3, MACON3_PADCFG0 | MACON3_TXCRCEN | MACON3_FRMLNEN | MACON3_FULDPX); 
-      write_reg_word(MAIPG, 0x0C12);
-      write_reg_byte(MABBIPG, 0x12);
-      write_reg_word(MAMXFL, MAX_FRAMELEN);  
-      write_reg_byte(MAADR1, mac_address[0]);
-      write_reg_byte(MAADR2, mac_address[1]);
-      write_reg_byte(MAADR3, mac_address[2]);
-      write_reg_byte(MAADR4, mac_address[3]);
-      write_reg_byte(MAADR5, mac_address[4]);
-      write_reg_byte(MAADR6, mac_address[5]);
+      // the register setup, in one batch - the order within each bank is kept
+      ENC28J60Op ops[40];
+      ENC28J60Batch batch(ops, 40);
+      batch.write_word(ERDPT, RXSTART_INIT);   // Buffer Serial Read Pointer
+      batch.write_word(EWRPT, TXSTART_INIT);   // Buffer Serial Write Pointer
+      batch.write_word(ETXST, TXSTART_INIT);   // TX Buffer Start
+      batch.write_word(ETXND, TXSTOP_INIT);    // TX Buffer Stop
+      batch.write_word(ERXST, RXSTART_INIT);   // RX Buffer Start
+      batch.write_word(ERXND, RXSTOP_INIT);    // RX Buffer Stop
+      batch.write_word(ERXRDPT, RXSTART_INIT);  // RX Read (Lock) Pointer
+      // batch.write_word(ERXWRPT, RXSTART_INIT); // RX Write Pointer - should be reset to RXSTART_INIT
+      batch.write(ERXFCON, ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_PMEN|ERXFCON_BCEN); // enable_broadcast()
+      batch.write_word(EPMM0, 0x303f);
+      batch.write_word(EPMCS, 0xf7f9);
+      batch.write(MACON1, MACON1_MARXEN | MACON1_TXPAUS | MACON1_RXPAUS);
+      batch.write(MACON2, 0x00);
+      batch.bit_set(MACON3, MACON3_PADCFG0 | MACON3_TXCRCEN | MACON3_FRMLNEN | MACON3_FULDPX); 
+      batch.write_word(MAIPG, 0x0C12);
+      batch.write(MABBIPG, 0x12);
+      batch.write_word(MAMXFL, MAX_FRAMELEN);  
+      batch.write(MAADR1, mac_address[0]);
+      batch.write(MAADR2, mac_address[1]);
+      batch.write(MAADR3, mac_address[2]);
+      batch.write(MAADR4, mac_address[3]);
+      batch.write(MAADR5, mac_address[4]);
+      batch.write(MAADR6, mac_address[5]);
+      run(&batch, true);
       write_phy_word(PHCON1, PHCON1_PDPXMD);
       write_phy_word(PHCON2, PHCON2_HDLDIS);
       // write_phy_word(PHLCON, 0b0011 0100 0010 0010 ); // default 
       write_phy_word(PHLCON, 0b0011111011010010 );
-      switch_bank(ECON1);
       write_op(OP_BITSET_REGISTER, EIE, EIE_INTIE | EIE_PKTIE);
       write_op(OP_BITSET_REGISTER, ECON1, ECON1_RXEN);
       // get the device revision, which should be 0x06.
@@ -512,10 +880,12 @@ class ENC28J60 : public SPIDevice {
         
     // 
     byte read_op(byte op, byte address) {
-        byte buffer[] = { op|(address & ADDR_MASK), 0, 0 };
-        byte n = (address & 0x80)?3:2; // is it an extended address?
-        transfer_bytes( buffer, n );
-        return buffer[n-1];
+        select();
+        SPI.transfer(op|(address & ADDR_MASK));
+        if(address & SPRD_MASK) SPI.transfer(0); // MAC and MII registers send a dummy byte first
+        byte b = SPI.transfer(0);
+        deselect();
+        return b;
     }
     /*
     byte read_eth(byte op, byte address) {
@@ -532,17 +902,32 @@ class ENC28J60 : public SPIDevice {
     */
     
     void write_op(byte op, byte address, byte data) {
-      byte buffer[] = { op|(address & ADDR_MASK), data };
-      transfer_bytes( buffer,2 );
+      select();
+      SPI.transfer(op|(address & ADDR_MASK));
+      SPI.transfer(data);
+      deselect();
     }
     
 
+    // select the register's bank, only touching the bank select bits that have to change
     void switch_bank(byte address) {
-      if ((address & BANK_MASK) != _current_bank) {
-        write_op(OP_BITCLR_REGISTER, ECON1, ECON1_BSEL1|ECON1_BSEL0);
-        _current_bank = address & BANK_MASK;
-        write_op(OP_BITSET_REGISTER, ECON1, _current_bank>>5);
+      if(common_reg(address)) return;
+      byte bank = address & BANK_MASK;
+      if(bank == _current_bank) return;
+      byte want = bank>>5;
+      byte clear, set;
+      if(_current_bank == 0xFF) {
+        // unknown, so do both
+        clear = ECON1_BSEL1|ECON1_BSEL0;
+        set = want;
+      } else {
+        byte have = _current_bank>>5;
+        clear = have & ~want;
+        set = want & ~have;
       }
+      if(clear) write_op(OP_BITCLR_REGISTER, ECON1, clear);
+      if(set) write_op(OP_BITSET_REGISTER, ECON1, set);
+      _current_bank = bank;
     }
     
 
@@ -551,5 +936,29 @@ class ENC28J60 : public SPIDevice {
 
 
 
+/*
+  ENC28J60Page is a read-only view of the packet the ENC28J60 is currently receiving (between
+  rx_begin and rx_end), read straight out of the chip's buffer. So a Cursor or parser can look
+  at the headers in place, and only the bytes you actually want ever come across the SPI bus.
+*/
+class ENC28J60Page : public ReadPage {
+  private:
+    ENC28J60 * eth;
+    word offset;
+  public:
+    // constructor
+    ENC28J60Page(ENC28J60 * eth) {
+      this->eth = eth;
+      offset = 0;
+    }
+    ENC28J60Page(ENC28J60 * eth, word offset) {
+      this->eth = eth;
+      this->offset = offset;
+    }
+    void read(word index, void * v, int count) { eth->rx_read(offset + index, v, count); }
+    Page * clone(int offset) { return new ENC28J60Page(eth, this->offset + offset); }
+    word length() { return eth->rx_length - offset; }
+};
+
 #endif
 #endif
\ No newline at end of file
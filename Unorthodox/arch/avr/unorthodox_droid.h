@@ -1139,4 +1139,43 @@ private:
 	}
 };
 
+/*
+  Scheduler adapters, so the droid parts can run as tasks instead of from hand-timed code in loop():
+
+    Scheduler tasks(8);
+    DroidTask droid_task(&droid);
+    BeepsTask beeps_task(&beeps);
+    MotivatorTask motivator_task(&motivator);
+    void setup() {
+      tasks.every(&droid_task, 10);
+      tasks.every(&beeps_task, 1);
+      tasks.every(&motivator_task, 20);
+    }
+    void loop() { tasks.run(); }
+ */
+class DroidTask : public Task {
+private:
+	BaseDroid * droid;
+public:
+	DroidTask(BaseDroid * droid) { this->droid = droid; }
+	void run(int dt) { droid->exec(dt); }
+};
+
+class BeepsTask : public Task {
+private:
+	DroidBeeps * beeps;
+public:
+	BeepsTask(DroidBeeps * beeps) { this->beeps = beeps; }
+	void run(int dt) { beeps->exec(dt); }
+};
+
+class MotivatorTask : public Task {
+private:
+	Motivator * motivator;
+public:
+	MotivatorTask(Motivator * motivator) { this->motivator = motivator; }
+	void run(int dt) { motivator->pulse(); }
+};
+
+
 #endif
\ No newline at end of file
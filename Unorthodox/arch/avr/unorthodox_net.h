@@ -0,0 +1,442 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+*/
+
+#ifndef UNORTHODOX_NET_H
+#define UNORTHODOX_NET_H
+
+// the network stack sits on the ENC28J60, so it needs the SPI library too
+#ifdef _SPI_H_INCLUDED
+
+
+/*
+  NetChecksum is the internet (ones-complement) checksum, added to a few bytes at a time as they
+  go past, so it can be worked out while a packet is being streamed rather than afterwards.
+  Bytes are paired up big-endian however the pieces happen to be split.
+*/
+class NetChecksum {
+  private:
+    unsigned long sum;
+    bool odd;           // the last byte added was the high half of a pair
+  public:
+    // constructor
+    NetChecksum() { reset(); }
+    void reset() {
+      sum = 0;
+      odd = false;
+    }
+    void add(byte b) {
+      if(odd) sum += b; else sum += (word)b << 8;
+      odd = !odd;
+    }
+    void add(const void * v, word count) {
+      const byte * p = (const byte *)v;
+      if(odd && count) { add(*p++); count--; }
+      for(; count>1; count-=2, p+=2) sum += ((word)p[0] << 8) | p[1];
+      if(count) add(*p);
+    }
+    // a whole 16 bit value. (these can go in at any point - only add() cares about pairing)
+    void add_word(word w) { sum += w; }
+    // the checksum to put in the packet. (a received packet checks out if this is zero)
+    word result() {
+      unsigned long s = sum;
+      while(s >> 16) s = (s & 0xFFFF) + (s >> 16);
+      return ~s;
+    }
+};
+
+
+/*
+  A UDPSocket receives the datagrams sent to its port. Subclass it and implement receive(), which
+  is handed the payload as a Page that reads straight out of the ENC28J60 - so only the bytes you
+  look at cross the SPI bus.
+
+  While receive() is running, remote_ip and remote_port say who sent it, and NetStack::reply()
+  will start a datagram back to them.
+*/
+class UDPSocket {
+  public:
+    word port;
+    byte remote_ip[4];
+    word remote_port;
+    UDPSocket * next_socket;
+
+    // constructor
+    UDPSocket(word port) {
+      this->port = port;
+      remote_port = 0;
+      next_socket = 0;
+      for(byte i=0; i<4; i++) remote_ip[i] = 0;
+    }
+    virtual void receive(ReadPage * data, word length) = 0;
+};
+
+
+/*
+  NetStack is a minimal ARP + IPv4 + UDP layer for the ENC28J60, aimed at streaming telemetry.
+
+  Received frames are parsed in place in the chip's buffer (see ENC28J60Page). ARP requests for
+  our address are answered, and the sender of every ARP or IP packet on the local network is
+  remembered in a small cache, so replies don't need a lookup on the wire. (Senders from further
+  away are reached through the gateway, so they'd only push its entry out of the cache.) IP
+  options and fragments are dropped. UDP checksums on received datagrams aren't checked (they're
+  optional in IPv4), but IP header checksums are.
+
+  Sending builds the frame in the chip's transmit buffer: the headers go in with blank lengths
+  and checksums, the payload is streamed in behind them with write(), and send() goes back and
+  fills in the blanks. The UDP checksum is done by the chip's DMA checksum engine, or in software
+  as the payload goes past if dma_checksum is turned off. (If the DMA engine ever fails to finish,
+  send() reads the datagram back out of the chip and sums it in software instead.)
+
+    NetStack net(&eth, my_ip);
+    void loop() {
+      net.poll();
+      if(net.begin(host_ip, 5000, 5000)) {
+        net.write(&sample, sizeof(sample));
+        net.send();
+      }
+    }
+
+  begin() returns false until the destination's MAC address is known, sending an ARP request
+  (at most once a second) to find it. Sending to 255.255.255.255 needs no ARP at all.
+
+  Every begin() that succeeds must be followed by send(). The chip has one transmit buffer, so
+  an ARP request that comes in while a datagram is being written (such as from a socket's
+  receive()) is answered on the next poll() after it's sent.
+*/
+class NetStack {
+  public:
+    static const byte ARP_SIZE = 4;
+    // frame layout
+    static const word ETH_TYPE   = 12;
+    static const word ETH_DATA   = 14;
+    static const word IP_HEADER  = 14;
+    static const word UDP_HEADER = 34;
+    static const word UDP_DATA   = 42;
+    // ether types
+    static const word TYPE_ARP   = 0x0806;
+    static const word TYPE_IP    = 0x0800;
+    static const byte PROTO_UDP  = 17;
+
+    byte ip[4];
+    byte netmask[4];
+    byte gateway[4];
+    bool dma_checksum;
+    // accounts
+    word rx_packets;
+    word rx_dropped;
+    word tx_packets;
+
+  private:
+    struct ARPEntry {
+      byte ip[4];
+      byte mac[6];
+    };
+    ENC28J60 * eth;
+    ARPEntry arp[ARP_SIZE];
+    byte arp_used;
+    byte arp_next;        // the entry to replace next
+    byte arp_wanted[4];   // the address we last asked for
+    unsigned long arp_asked;
+    bool arp_reply_due;   // an ARP request that came in while tx_open, still to be answered
+    byte arp_reply_mac[6];
+    byte arp_reply_ip[4];
+    UDPSocket * sockets;
+    word ip_id;
+    // the datagram being sent
+    bool tx_open;         // between begin() and send() - the transmit buffer is ours
+    byte tx_ip[4];
+    word tx_src_port;
+    word tx_dst_port;
+    word tx_payload;
+    NetChecksum tx_sum;
+
+  public:
+    // constructor
+    NetStack(ENC28J60 * eth, const byte * address) {
+      this->eth = eth;
+      for(byte i=0; i<4; i++) {
+        ip[i] = address[i];
+        netmask[i] = 255;
+        gateway[i] = 0;
+        arp_wanted[i] = 0;
+      }
+      netmask[3] = 0;
+      dma_checksum = true;
+      rx_packets = 0;
+      rx_dropped = 0;
+      tx_packets = 0;
+      arp_used = 0;
+      arp_next = 0;
+      arp_asked = 0;
+      arp_reply_due = false;
+      sockets = 0;
+      ip_id = 0;
+      tx_open = false;
+      tx_payload = 0;
+    }
+
+    // start receiving datagrams for a socket
+    void bind(UDPSocket * socket) {
+      socket->next_socket = sockets;
+      sockets = socket;
+    }
+
+    // handle everything that has arrived. returns how many frames there were.
+    byte poll() {
+      answer_arp();
+      byte n = 0;
+      while(eth->rx_begin()) {
+        if(eth->rx_status & 0x80) receive(); else rx_dropped++;
+        eth->rx_end();
+        n++;
+      }
+      return n;
+    }
+    // the same, for packets queued by ENC28J60::rx_interrupt()
+    byte poll(HALQueue * packets) {
+      answer_arp();
+      byte n = 0;
+      ENC28J60Packet * p;
+      while((p = (ENC28J60Packet *)packets->dequeue())) {
+        eth->rx_select(p);
+        if(p->status & 0x80) receive(); else rx_dropped++;
+        eth->rx_release(p);
+        n++;
+      }
+      return n;
+    }
+
+    // start a datagram. false if the destination's MAC isn't known yet, or the chip is still busy.
+    bool begin(const byte * to, word src_port, word dst_port) {
+      byte mac[6];
+      if(!resolve(to, mac)) return false;
+      if(!eth->tx_begin()) return false;
+      tx_open = true;
+      for(byte i=0; i<4; i++) tx_ip[i] = to[i];
+      tx_src_port = src_port;
+      tx_dst_port = dst_port;
+      tx_payload = 0;
+      tx_sum.reset();
+      // ethernet header
+      byte header[UDP_DATA];
+      for(byte i=0; i<6; i++) { header[i] = mac[i]; header[6+i] = eth->mac_address[i]; }
+      put_word(header + ETH_TYPE, TYPE_IP);
+      // IP header, with the length and checksum left blank
+      ip_id++;
+      ip_header(header + IP_HEADER, 0);
+      // UDP header, likewise
+      byte * h = header + UDP_HEADER;
+      put_word(h, src_port);
+      put_word(h+2, dst_port);
+      put_word(h+4, 0);
+      put_word(h+6, 0);
+      eth->tx_write(header, UDP_DATA);
+      return true;
+    }
+    // start a datagram back to whoever sent the one a socket is receiving
+    bool reply(UDPSocket * socket) {
+      return begin(socket->remote_ip, socket->port, socket->remote_port);
+    }
+    // add to the payload
+    void write(const void * v, word count) {
+      eth->tx_write(v, count);
+      if(!dma_checksum) tx_sum.add(v, count);
+      tx_payload += count;
+    }
+    void write(byte b) { write(&b, 1); }
+    // fill in the blanks and send it
+    void send() {
+      word udp_length = 8 + tx_payload;
+      // the IP and UDP headers go back in as one piece (they're next to each other)
+      byte h[28];
+      ip_header(h, 20 + udp_length);
+      NetChecksum sum;
+      sum.add(h, 20);
+      put_word(h+10, sum.result());
+      put_word(h+20, tx_src_port);
+      put_word(h+22, tx_dst_port);
+      put_word(h+24, udp_length);
+      put_word(h+26, 0);
+      eth->tx_write_at(IP_HEADER, h, 28);
+      // then the checksum over the pseudo-header, UDP header and payload
+      if(dma_checksum) {
+        // the chip did the header and payload. fold that back in with the pseudo-header
+        word partial;
+        tx_sum.reset();
+        if(eth->tx_checksum(UDP_HEADER, udp_length, &partial)) {
+          tx_sum.add_word((word)~partial);
+        } else {
+          // it didn't finish, so read them back and do them here
+          byte b[16];
+          for(word i=0; i<udp_length; i+=16) {
+            word n = (udp_length - i < 16) ? udp_length - i : 16;
+            eth->tx_read(UDP_HEADER + i, b, n);
+            tx_sum.add(b, n);
+          }
+        }
+      } else {
+        tx_sum.add_word(tx_src_port);
+        tx_sum.add_word(tx_dst_port);
+        tx_sum.add_word(udp_length);
+      }
+      for(byte i=12; i<20; i+=2) tx_sum.add_word(get_word(h+i));
+      tx_sum.add_word(PROTO_UDP);
+      tx_sum.add_word(udp_length);
+      word check = tx_sum.result();
+      if(check==0) check = 0xFFFF; // zero means 'no checksum'
+      byte fix[2];
+      put_word(fix, check);
+      eth->tx_write_at(UDP_HEADER + 6, fix, 2);
+      eth->tx_send();
+      tx_open = false;
+      tx_packets++;
+    }
+
+    // ask who has an address (the answer arrives through poll)
+    void arp_request(const byte * address) {
+      if(tx_open || !eth->tx_begin()) return;
+      byte broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+      byte zero[6] = { 0, 0, 0, 0, 0, 0 };
+      send_arp(1, broadcast, zero, address);
+    }
+
+  private:
+    // an IPv4 header from us to tx_ip, checksum blank
+    void ip_header(byte * h, word length) {
+      h[0] = 0x45; h[1] = 0;
+      put_word(h+2, length);
+      put_word(h+4, ip_id);
+      put_word(h+6, 0x4000);    // don't fragment
+      h[8] = 64; h[9] = PROTO_UDP;
+      put_word(h+10, 0);
+      for(byte i=0; i<4; i++) { h[12+i] = ip[i]; h[16+i] = tx_ip[i]; }
+    }
+    static void put_word(byte * p, word w) { p[0] = w >> 8; p[1] = w & 0xFF; }
+    static word get_word(const byte * p) { return ((word)p[0] << 8) | p[1]; }
+    static bool same_ip(const byte * a, const byte * b) {
+      return (a[0]==b[0]) && (a[1]==b[1]) && (a[2]==b[2]) && (a[3]==b[3]);
+    }
+
+    void receive() {
+      rx_packets++;
+      // (nothing we handle is shorter than a UDP header)
+      if(eth->rx_length < UDP_DATA) { rx_dropped++; return; }
+      byte header[ETH_DATA];
+      eth->rx_read(0, header, ETH_DATA);
+      word type = get_word(header + ETH_TYPE);
+      if(type==TYPE_ARP) receive_arp();
+      else if(type==TYPE_IP) receive_ip(header + 6);
+    }
+
+    void receive_arp() {
+      // hardware, protocol, sizes, operation, sender MAC, sender IP, target MAC, target IP
+      byte a[28];
+      eth->rx_read(ETH_DATA, a, 28);
+      if(get_word(a)!=1 || get_word(a+2)!=TYPE_IP || a[4]!=6 || a[5]!=4) return;
+      bool for_us = same_ip(a+24, ip);
+      // a request for us, or a reply to our request
+      if(for_us) learn(a+14, a+8);
+      if(for_us && get_word(a+6)==1) {
+        // (not while a datagram is half written - that would overwrite it)
+        for(byte i=0; i<6; i++) arp_reply_mac[i] = a[8+i];
+        for(byte i=0; i<4; i++) arp_reply_ip[i] = a[14+i];
+        arp_reply_due = true;
+        answer_arp();
+      }
+    }
+    // send the ARP reply that's due, if the transmit buffer is free
+    void answer_arp() {
+      if(!arp_reply_due || tx_open) return;
+      if(!eth->tx_begin()) return;
+      arp_reply_due = false;
+      send_arp(2, arp_reply_mac, arp_reply_mac, arp_reply_ip);
+    }
+
+    void send_arp(word operation, const byte * dst_mac, const byte * target_mac, const byte * target_ip) {
+      byte f[ETH_DATA + 28];
+      for(byte i=0; i<6; i++) { f[i] = dst_mac[i]; f[6+i] = eth->mac_address[i]; }
+      put_word(f + ETH_TYPE, TYPE_ARP);
+      byte * a = f + ETH_DATA;
+      put_word(a, 1);
+      put_word(a+2, TYPE_IP);
+      a[4] = 6; a[5] = 4;
+      put_word(a+6, operation);
+      for(byte i=0; i<6; i++) { a[8+i] = eth->mac_address[i]; a[18+i] = target_mac[i]; }
+      for(byte i=0; i<4; i++) { a[14+i] = ip[i]; a[24+i] = target_ip[i]; }
+      eth->tx_write(f, sizeof(f));
+      eth->tx_send();
+      tx_packets++;
+    }
+
+    void receive_ip(const byte * src_mac) {
+      byte h[28]; // IP header and UDP header
+      eth->rx_read(IP_HEADER, h, 28);
+      // plain IPv4, no options, not a fragment, for us (or broadcast)
+      if(h[0]!=0x45 || (get_word(h+6) & 0x3FFF)) { rx_dropped++; return; }
+      if(!same_ip(h+16, ip) && !(h[16]==255 && h[17]==255 && h[18]==255 && h[19]==255)) return;
+      NetChecksum sum;
+      sum.add(h, 20);
+      if(sum.result()!=0) { rx_dropped++; return; }
+      learn(h+12, src_mac);
+      if(h[9]!=PROTO_UDP) return;
+      word length = get_word(h+24);
+      word ip_length = get_word(h+2);
+      if(ip_length < 28 || length < 8 || length > ip_length - 20 || ip_length > eth->rx_length - ETH_DATA) { rx_dropped++; return; }
+      word port = get_word(h+22);
+      for(UDPSocket * s = sockets; s; s = s->next_socket) {
+        if(s->port!=port) continue;
+        for(byte i=0; i<4; i++) s->remote_ip[i] = h[12+i];
+        s->remote_port = get_word(h+20);
+        ENC28J60Page data(eth, UDP_DATA);
+        s->receive(&data, length - 8);
+        return;
+      }
+    }
+
+    // remember where an address is, if it's on the local network
+    void learn(const byte * address, const byte * mac) {
+      if(!local(address)) return;
+      ARPEntry * e = find(address);
+      if(!e) {
+        if(arp_used < ARP_SIZE) e = &arp[arp_used++];
+        else { e = &arp[arp_next]; arp_next = (arp_next + 1) % ARP_SIZE; }
+        for(byte i=0; i<4; i++) e->ip[i] = address[i];
+      }
+      for(byte i=0; i<6; i++) e->mac[i] = mac[i];
+    }
+    bool local(const byte * address) {
+      for(byte i=0; i<4; i++) if((address[i] ^ ip[i]) & netmask[i]) return false;
+      return true;
+    }
+    ARPEntry * find(const byte * address) {
+      for(byte i=0; i<arp_used; i++) if(same_ip(arp[i].ip, address)) return &arp[i];
+      return 0;
+    }
+
+    // the MAC address to send to, or false (and ask for it) if we don't know it yet
+    bool resolve(const byte * to, byte * mac) {
+      if(to[0]==255 && to[1]==255 && to[2]==255 && to[3]==255) {
+        for(byte i=0; i<6; i++) mac[i] = 0xFF;
+        return true;
+      }
+      // off the local network, it goes to the gateway
+      const byte * hop = local(to) ? to : gateway;
+      ARPEntry * e = find(hop);
+      if(e) {
+        for(byte i=0; i<6; i++) mac[i] = e->mac[i];
+        return true;
+      }
+      unsigned long now = millis();
+      if(!same_ip(hop, arp_wanted) || (now - arp_asked >= 1000)) {
+        for(byte i=0; i<4; i++) arp_wanted[i] = hop[i];
+        arp_asked = now;
+        arp_request(hop);
+      }
+      return false;
+    }
+};
+
+
+#endif
+#endif
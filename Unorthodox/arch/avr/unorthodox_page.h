@@ -18,7 +18,7 @@ public:
 	virtual Page * clone(int offset) = 0;
 	// old methods
 	byte read_byte(word index) { byte b; read(index, &b, 1); return b; }
-	word read_word(word index) { word w; read(index, &w, 2);  return w; }
+	word read_word(word index) { uint16_t w; read(index, &w, 2);  return w; }
 	void write_byte(word index, byte b) { write(index, &b, 1); }
 	void write_word(word index, word w) { write(index, &w, 2); }
 	// new methods
@@ -555,7 +555,7 @@ public:
 	}
 
 	~TokenFS() {
-		delete token;
+		delete[] token;
 	}
 
 	/*
@@ -589,6 +589,7 @@ public:
 			}
 			// Serial.print("\n used "); Serial.print(used); 
 		}
+		return 0;
 	}
 
 	/*
@@ -625,5 +626,525 @@ public:
 
 };
 
+
+/*
+	HashTokenFS is a TokenFS for sparse id spaces. Ids are full 16-bit words (stored as the first two
+	bytes of each block) and instead of a pointer for every possible id, we keep an open-addressed
+	hash table of just the live ones: (id, block) pairs, probed linearly from the id's hash.
+
+	The table is a power of two in size, and doubles whenever the live count would go over
+	max_load percent of it. Removals shift the following entries of the run back into the gap
+	('backward-shift' deletion) so there are never any tombstones slowing down later probes.
+
+	Memory, for the droid's table of 192 possible ids:
+		TokenFS                  2 bytes * 192 ids                      = 384 bytes, always
+		HashTokenFS (75% load)   4 bytes * next power of two >= live/0.75
+		                         = 128 bytes for up to 24 live, 256 for up to 48, 512 up to 96
+	so the hash wins while fewer than about a third of the ids are in use, and it's the only
+	option at all when ids are scattered over 16 bits.
+
+	Lookup cost: a dense table is one indexed load. Linear probing at load factor a takes about
+	(1 + 1/(1-a))/2 probes to find a live id and (1 + 1/(1-a)^2)/2 to miss, so 2.5 and 8.5 at 75%,
+	1.5 and 2.5 at 50%. Since the table only ever doubles, the real load sits between half of
+	max_load and max_load. Lower max_load if you care more about time than memory. (it can't go
+	above 90%, and tools/tokenfs-bench.cpp measures both tables on the desktop)
+
+	Growing the table allocates the new one before releasing the old, so there must be room for
+	both for a moment. If that fails we carry on in the old table for as long as it has space.
+ */
+struct HashToken {
+	word id;
+	word block; // zero for an empty slot
+};
+
+class HashTokenFS : public JournalFS {
+private:
+	HashToken * table;
+	word mask;  // capacity - 1
+	byte shift; // hash shift for the current capacity
+
+	// home slot of an id. (Knuth's multiplicative hash, spread from the top bits)
+	word home(word id) {
+		return ((word)(id * 40503U) >> shift) & mask;
+	}
+
+	// slot holding the id, or the empty slot where it would go
+	word probe(word id) {
+		word s = home(id);
+		while(table[s].block && (table[s].id != id)) s = (s + 1) & mask;
+		return s;
+	}
+
+	// is there room for one more id, growing the table if we need to?
+	bool reserve() {
+		if((word)(((unsigned long)(live + 1) * 100) / (mask + 1)) <= max_load) return true;
+		if(resize((mask + 1) << 1)) return true;
+		// couldn't grow. keep going while there's at least one empty slot left
+		return live + 1 < mask + 1;
+	}
+
+	bool resize(word capacity) {
+		HashToken * old = table;
+		word old_capacity = mask + 1;
+		HashToken * t = new HashToken[capacity];
+		if(t == 0) return false;
+		memset(t, 0, capacity * sizeof(HashToken));
+		table = t;
+		mask = capacity - 1;
+		shift = 16;
+		while(capacity > 1) { capacity >>= 1; shift--; }
+		// re-home all the live entries
+		for(word i = 0; i < old_capacity; i++) {
+			if(old[i].block) table[probe(old[i].id)] = old[i];
+		}
+		delete[] old;
+		return true;
+	}
+
+	// false if the id is new and there's no room for it
+	bool index_set(word id, word block) {
+		word s = probe(id);
+		if(table[s].block == 0) {
+			if(!reserve()) return false;
+			// the table may have moved
+			s = probe(id);
+			live++;
+		}
+		table[s].id = id;
+		table[s].block = block;
+		return true;
+	}
+
+	void index_remove(word id) {
+		word s = probe(id);
+		if(table[s].block == 0) return;
+		live--;
+		// shift later members of the run back into the gap, unless that would move them
+		// before their home slot
+		word gap = s;
+		while(true) {
+			s = (s + 1) & mask;
+			if(table[s].block == 0) break;
+			word h = home(table[s].id);
+			// can the entry at s legally live in the gap? (is its home cyclically outside gap+1..s)
+			if(((s - h) & mask) >= ((s - gap) & mask)) {
+				table[gap] = table[s];
+				gap = s;
+			}
+		}
+		table[gap].block = 0;
+	}
+
+	// current block for an id, or zero
+	word index_get(word id) {
+		return table[probe(id)].block;
+	}
+
+public:
+	word live;     // how many ids are in the table
+	word used;     // storage used by live blocks, like TokenFS
+	byte max_load; // percentage, at most 90
+
+	// constructor. capacity is the initial table size, and must be a power of two (of at least 2).
+	// max_load is capped at 90%, so the table always keeps an empty slot for probes to stop at.
+	HashTokenFS(Page * page, word size, word capacity, byte max_load) : JournalFS(page,size) {
+		if(max_load > 90) max_load = 90;
+		this->max_load = max_load;
+		live = 0;
+		used = 0;
+		if(capacity < 2) capacity = 2;
+		table = new HashToken[capacity];
+		memset(table, 0, capacity * sizeof(HashToken));
+		mask = capacity - 1;
+		shift = 16;
+		while(capacity > 1) { capacity >>= 1; shift--; }
+	}
+
+	~HashTokenFS() {
+		delete[] table;
+	}
+
+	// bytes of RAM the index is taking
+	word index_memory() {
+		return (mask + 1) * sizeof(HashToken);
+	}
+
+	/*
+	 * respond to block notifications and validity requests
+	 */
+	int block_state(word index, word count, int mode) {
+		word id = page->read_word(index);
+		word current = index_get(id);
+		if(mode==0) {
+			// block verification
+			return (current == index) && (count>2);
+		} else if(mode==1) {
+			// block notification
+			if(current) { used -= token_size(id) + 7; } // un-account for the old block
+			if(count>2) {
+				// only count the block if we could index it
+				if(index_set(id, index)) used += token_size(id) + 7;
+			} else {
+				index_remove(id);
+			}
+		} else if(mode==2) {
+			// block reclaim
+			if(current==index) {
+				used -= token_size(id) + 7;
+				index_remove(id);
+			}
+		}
+		return 0;
+	}
+
+	/*
+	 * Create a new Page accessor
+	 */
+	Page * token_page(word id) {
+		word i = index_get(id);
+		if(i==0) return 0;
+		return page->clone(i + 2);
+	}
+
+	word token_size(word id) {
+		word i = index_get(id);
+		if(i==0) return 0;
+		// the block size byte is just before the block, and includes the id
+		return page->read_byte(i - 1) - 2;
+	}
+
+	// write a token. The source must start with the two byte id, which count includes.
+	bool token_write(word id, Page * source, int count) {
+		// discard old entry before defragmentation
+		if(index_get(id)) {
+			used -= token_size(id) + 7;
+			index_remove(id);
+		} else {
+			// don't bother if the token is empty (apart from the id header)
+			if(count==2) return true;
+		}
+		// make sure we'll be able to index it once it's written
+		if((count > 2) && !reserve()) return false;
+		// write new token page to the journal. we will be notified if successful.
+		return journal_append(source, count);
+	}
+
+};
+
+/*
+	KeyFS is a key/value store over the journal, for when there are more keys than TokenFS can
+	afford a RAM pointer for. Keys are 16-bit words, and values are short byte strings.
+
+	Records are grouped into 'buckets', each of which is one journal block:
+
+		[lowkey:2] [key:2 length:1 data...] [key:2 length:1 data...] ...
+
+	with the records in key order. A bucket holds every key from its lowkey up to the next bucket's
+	lowkey, so the only thing we have to keep in RAM is the table of buckets (four bytes each) and
+	not a pointer for every key. That table is rebuilt by the journal scan at start() like any other
+	index. It's really just the top level of a B-tree, with the leaves out in storage.
+
+	Writing a key rewrites its whole bucket, and when one grows past bucket_max it splits in two:
+	the upper half is written first as a new bucket, then the lower half. If we lose power between
+	the two, the old lower bucket still holds copies of the upper keys, but those are out of its
+	range and will never be found (and get dropped the next time it's written). A bucket that
+	empties is written once more as just its lowkey, which removes it from the table and merges
+	its range into the bucket below - so the bucket below is scrubbed of any such stale copies
+	first, or they would come back into range.
+
+	Lookups are a binary search of the bucket table and a short scan of one bucket. A small
+	direct-mapped cache remembers where recently found values live, so polling the same few keys
+	doesn't scan at all. Any journal activity empties the cache, since blocks may have moved.
+
+	Memory: 4 bytes per bucket, plus a rewrite buffer of 1.5x bucket_max, plus the 32 byte cache.
+	A 1K EEPROM with 64 byte buckets runs to about 25 buckets, so 100 bytes of table covers
+	everything the storage can hold, however many keys that turns out to be. A value can be at most (bucket_max / 2) - 4 bytes long, which
+	guarantees a full bucket can always split into two that fit.
+ */
+struct KeyBucket {
+	word low;   // lowest key that belongs in this bucket
+	word block; // journal block index, or zero if we've lost track of it
+};
+
+class KeyFS : public JournalFS {
+private:
+	static const byte KEY_CACHE = 8; // cache slots (power of two)
+	word cache_key[KEY_CACHE];
+	word cache_data[KEY_CACHE];
+	byte * buffer; // bucket rewrite buffer
+
+	void cache_clear() {
+		memset(cache_data, 0, sizeof(cache_data));
+	}
+
+	// find the bucket table entry with the greatest lowkey <= key, or -1 if there isn't one
+	int bucket_find(word key) {
+		int lo = 0;
+		int hi = bucket_count - 1;
+		int found = -1;
+		while(lo <= hi) {
+			int mid = (lo + hi) >> 1;
+			if(bucket[mid].low <= key) {
+				found = mid;
+				lo = mid + 1;
+			} else {
+				hi = mid - 1;
+			}
+		}
+		return found;
+	}
+
+	// add a bucket table entry at the right place. Returns the entry, or -1 if the table is full.
+	int bucket_insert(word low, word block) {
+		if(bucket_count >= buckets) return -1;
+		int i = bucket_count++;
+		while((i > 0) && (bucket[i-1].low > low)) {
+			bucket[i] = bucket[i-1];
+			i--;
+		}
+		bucket[i].low = low;
+		bucket[i].block = block;
+		return i;
+	}
+
+	void bucket_remove(int i) {
+		bucket_count--;
+		for(; i < bucket_count; i++) bucket[i] = bucket[i+1];
+	}
+
+	// append a bucket block from somewhere in the buffer
+	bool bucket_write(byte * b, word count) {
+		MemoryPage source(b);
+		return journal_append(&source, count);
+	}
+
+	// rewrite bucket i without any records at or above the next bucket's lowkey, if it has any.
+	// Fails rather than lose keys if we don't know where the bucket is.
+	bool bucket_scrub(int i) {
+		word p = bucket[i].block;
+		if(p == 0) return false;
+		word high = bucket[i+1].low;
+		word end = p + page->read_byte(p - 1);
+		word n = 2;
+		page->read(p, buffer, 2);
+		p += 2;
+		while(p < end) {
+			word k = page->read_word(p);
+			byte len = page->read_byte(p + 2);
+			if(k >= high) break;
+			page->read(p, buffer + n, len + 3);
+			n += len + 3;
+			p += len + 3;
+		}
+		// nothing out of range?
+		if(p >= end) return true;
+		// a bucket with only stale keys can't happen (its last key going would have emptied it)
+		if(n == 2) return false;
+		return bucket_write(buffer, n);
+	}
+
+public:
+	KeyBucket * bucket;
+	word buckets;      // size of the bucket table
+	word bucket_count; // how many are in use
+	byte bucket_max;   // bucket size at which we split
+
+	// constructor. bucket_max must be no more than 250, so buckets fit in a journal block.
+	KeyFS(Page * page, word size, word buckets, byte bucket_max) : JournalFS(page,size) {
+		this->buckets = buckets;
+		this->bucket_max = bucket_max;
+		bucket = new KeyBucket[buckets];
+		bucket_count = 0;
+		buffer = new byte[bucket_max + (bucket_max >> 1)];
+		cache_clear();
+	}
+
+	~KeyFS() {
+		delete[] bucket;
+		delete[] buffer;
+	}
+
+	/*
+	 * respond to block notifications and validity requests
+	 */
+	int block_state(word index, word count, int mode) {
+		word low = page->read_word(index);
+		int i = bucket_find(low);
+		if((i >= 0) && (bucket[i].low != low)) i = -1;
+		if(mode==0) {
+			// block verification. empty buckets are never kept.
+			return (i >= 0) && (bucket[i].block == index) && (count > 2);
+		}
+		// everything else moves blocks around
+		cache_clear();
+		if(mode==1) {
+			// block notification
+			if(count > 2) {
+				if(i >= 0) { bucket[i].block = index; } else { bucket_insert(low, index); }
+			} else if(i >= 0) {
+				// an empty bucket. it goes away.
+				bucket_remove(i);
+			}
+		} else if(mode==2) {
+			// block reclaim
+			if((i >= 0) && (bucket[i].block == index)) bucket[i].block = 0;
+		}
+		return 0;
+	}
+
+	/*
+	 * find the storage index of a key's value, or zero if it has none
+	 */
+	word key_find(word key) {
+		byte slot = key & (KEY_CACHE-1);
+		if(cache_data[slot] && (cache_key[slot] == key)) return cache_data[slot];
+		int i = bucket_find(key);
+		if(i < 0) return 0;
+		word p = bucket[i].block;
+		if(p == 0) return 0;
+		word end = p + page->read_byte(p - 1);
+		p += 2;
+		while(p < end) {
+			word k = page->read_word(p);
+			if(k == key) {
+				// found it. remember for next time
+				cache_key[slot] = key;
+				cache_data[slot] = p + 3;
+				return p + 3;
+			}
+			// records are in order, so we can stop early
+			if(k > key) break;
+			p += page->read_byte(p + 2) + 3;
+		}
+		return 0;
+	}
+
+	/*
+	 * Create a new Page accessor for the value of a key
+	 */
+	Page * key_page(word key) {
+		word p = key_find(key);
+		if(p == 0) return 0;
+		return page->clone(p);
+	}
+
+	byte key_size(word key) {
+		word p = key_find(key);
+		if(p == 0) return 0;
+		// the length byte is just before the value
+		return page->read_byte(p - 1);
+	}
+
+	/*
+	  Set the value of a key (or remove it, if count is zero) by rewriting its bucket.
+	  Fails if the value is too large, the bucket table is full, or the journal is out of space.
+	  Returns whether the new value is in place, which (after a split) it can be even when the
+	  journal ran out of space part way.
+	 */
+	bool key_write(word key, Page * source, byte count) {
+		if(count > (bucket_max >> 1) - 4) return false;
+		int i = bucket_find(key);
+		// rewriting a bucket we've lost track of would throw away all its other keys
+		if((i >= 0) && (bucket[i].block == 0)) return false;
+		word low = (i < 0) ? 0 : bucket[i].low;
+		// keys from the next bucket up don't belong here (there may be stale copies)
+		bool bounded = (i >= 0) && (i + 1 < bucket_count);
+		word high = bounded ? bucket[i+1].low : 0;
+		// rebuild the bucket in the buffer, with the new record in its place
+		buffer[0] = low & 0xFF;
+		buffer[1] = low >> 8;
+		word n = 2;
+		word split = 0; // where the new record went, if it was last
+		bool changed = false;
+		bool placed = (count == 0);
+		word p = (i < 0) ? 0 : bucket[i].block;
+		word end = (p == 0) ? 0 : p + page->read_byte(p - 1);
+		if(p) p += 2;
+		while(true) {
+			word k = 0;
+			byte len = 0;
+			bool more = (p < end);
+			if(more) {
+				k = page->read_word(p);
+				len = page->read_byte(p + 2);
+				if(bounded && (k >= high)) more = false;
+			}
+			if(!placed && (!more || (k > key))) {
+				// the new record goes in here
+				if(!more) split = n;
+				buffer[n++] = key & 0xFF;
+				buffer[n++] = key >> 8;
+				buffer[n++] = count;
+				source->read(0, buffer + n, count);
+				n += count;
+				placed = true;
+				changed = true;
+			}
+			if(!more) break;
+			if(k == key) {
+				// the old record is dropped
+				changed = true;
+			} else {
+				buffer[n++] = k & 0xFF;
+				buffer[n++] = k >> 8;
+				buffer[n++] = len;
+				page->read(p + 3, buffer + n, len);
+				n += len;
+			}
+			p += len + 3;
+		}
+		// removing a key we didn't have?
+		if(!changed) return true;
+		cache_clear();
+		if(n <= bucket_max) {
+			// a brand new bucket? we need room in the table for it
+			if((i < 0) && (bucket_count >= buckets)) return false;
+			if((n == 2) && (i > 0)) {
+				// emptying this bucket merges its range into the one below, which must lose any
+				// stale copies of our keys first. (that reuses the buffer, so put our lowkey back)
+				if(!bucket_scrub(i - 1)) return false;
+				buffer[0] = low & 0xFF;
+				buffer[1] = low >> 8;
+			}
+			// (the old block stays current until the new one lands, since it holds other keys too)
+			return bucket_write(buffer, n);
+		}
+		// too big. we need a new bucket table entry for the upper half
+		if(bucket_count >= buckets) return false;
+		if(split <= 2) {
+			// the new record wasn't on the end, so pick the record boundary nearest the middle
+			// that leaves both halves small enough
+			word best = 0;
+			word r = 2;
+			while(r < n) {
+				if((r > 2) && (r <= bucket_max) && (n - r + 2 <= bucket_max)) {
+					if((best == 0) || (abs((int)(r << 1) - (int)n) < abs((int)(best << 1) - (int)n))) best = r;
+				}
+				r += buffer[r + 2] + 3;
+			}
+			split = best;
+			if(split == 0) return false;
+		}
+		// write the upper bucket first, with its lowkey in front of the first record
+		word upper_low = buffer[split] | (buffer[split + 1] << 8);
+		byte save0 = buffer[split - 2];
+		byte save1 = buffer[split - 1];
+		buffer[split - 2] = upper_low & 0xFF;
+		buffer[split - 1] = upper_low >> 8;
+		bool ok = bucket_write(buffer + split - 2, n - split + 2);
+		buffer[split - 2] = save0;
+		buffer[split - 1] = save1;
+		if(!ok) return false;
+		// then the lower half, which replaces the old bucket. If there's no room for it, the old
+		// bucket stays current below upper_low - and the write has still taken effect if the new
+		// record went in the upper half, which is already live.
+		return bucket_write(buffer, split) || (key >= upper_low);
+	}
+
+	bool key_erase(word key) {
+		return key_write(key, 0, 0);
+	}
+};
+
 	 
 #endif
@@ -11,13 +11,24 @@ public:
 
 /*
   Interrupt-safe Queues
+
+  Any number of interrupt levels can enqueue, and the main loop dequeues. An enqueue swaps
+  itself in as the new tail, and only then links the old tail to it. The swap is the only
+  part that must not be interrupted, so interrupts are masked for those few instructions
+  and never for longer - however long the chain being added, and however deeply the
+  interrupts are nested.
+
+  An interrupt can land between the swap and the link. For a moment the chain is then broken
+  just before the new node, and dequeue() stops there and reports an empty queue. The
+  interrupted enqueue finishes the link when it resumes, and nothing is lost.
+
+  There's no shared state between queues, and nothing to tell the queue about which interrupt
+  level you're at, so independent queues don't cost each other anything.
+
+  The queue itself is the sentinel node. It's recycled to the tail whenever it reaches the head,
+  so the last real node can always be taken.
  */
 class HALQueue : private HALNode {
-private:
-	// class static
-	static HALQueue * _interrupt_queue[16];
-	static HALNode *  _interrupt_node[16];
-	static byte _interrupt_level;
 public:
 	// constructor
 	HALQueue() { 
@@ -26,129 +37,67 @@ public:
 		tail = this;
 	}
 	// queue methods
+	// add a node, or a pre-linked chain of them (which is followed to find the end)
 	void enqueue(HALNode * node) {
-		hal_queue_enqueue(this, node);
+		HALNode * last = node;
+		while(last->next) last = last->next;
+		hal_queue_enqueue(this, node, last);
+	}
+	// add a pre-linked chain, when the caller already knows where it ends
+	void enqueue(HALNode * first, HALNode * last) {
+		last->next = 0;
+		hal_queue_enqueue(this, first, last);
 	}
 	HALNode * dequeue() {
 		return hal_queue_dequeue(this,this);
 	}
-	static void set_interrupt(byte n) { _interrupt_level = n; }
+	// take everything queued so far in one go, and walk it with batch_next():
+	//   for(HALNode * n = queue.dequeue_all(); n; n = queue.batch_next(n)) { ... }
+	// anything enqueued meanwhile waits for the next call.
+	HALNode * dequeue_all() {
+		return hal_queue_dequeue_all(this,this);
+	}
+	// the node after this one in a batch (or zero at the end). unlinks the node as it goes.
+	HALNode * batch_next(HALNode * node) {
+		HALNode * link = node->next;
+		node->next = 0;
+		return (link == this) ? 0 : link;
+	}
+	// interrupt levels used to be tracked by hand. nothing needs them now, so this does nothing.
+	static void set_interrupt(byte n) { }
 private:
 	// 
 	HALNode * head;
-	HALNode * tail;
+	HALNode * volatile tail;
 
 #define null 0
 
-	static HALNode * hal_chain_follow(HALNode * node) {
-		// follow the previous level's chain to the last entry
-		HALNode * next = node->next;
-		while(next != null) {
-			node = next;
-			next = node->next;
-		}
-		return node;
-	}
-
-	// search for the most recent interrupt level which was also modifying this queue
-	static int hal_queue_seeklevel(HALQueue * queue, int level) {  
-		while( --level >= 0 ) {
-			if( _interrupt_queue[level] == queue ) return level;
-		}
-		return -1;
-	}
-
-	// which node (reachable from the global table or chain tail) references a given node?
-	static HALNode * hal_chain_anchor(HALQueue * queue, HALNode * node, int level ) {
-		while( true ) {
-			// find the next level down
-			level = hal_queue_seeklevel(queue, level);
-			// which chain represents this level?
-			HALNode * link = ( level < 0 ) ? queue->tail : _interrupt_node[level];
-			// go through the chain and look for the node
-			while( link != null ) {
-				HALNode * next = link->next;
-				if(next == node) return link;
-				link = next;
-			}
-			// return if we ran out of levels to check, otherwise loop
-			if( level < 0 ) return null;
-		}
+	static void hal_queue_enqueue(HALQueue * queue, HALNode * first, HALNode * last) {
+		// swap ourselves in as the tail. (the only part that has to be atomic)
+		byte sreg = SREG;
+		cli();
+		HALNode * prev = queue->tail;
+		queue->tail = last;
+		SREG = sreg;
+		// now link the old tail to us. until we do, dequeue will stop short of our chain.
+		prev->next = first;
 	}
 
-	static void hal_queue_enqueue(HALQueue * queue, HALNode * node ) {
-		// what interrupt level are we at?
-		int level = _interrupt_level;
-		// ensure the chain references for this level start empty
-		// so there is never an invalid pair.
-		// assert( _interrupt_queue[level] == null );
-		// assert( _interrupt_node[level] == null );
-		// fill them with our values. order is very important in case we are interrupted
-		_interrupt_node[level] = node;
-		_interrupt_queue[level] = queue;
-		// interrupts will now append to our level. We can examine and correct the table in peace.
-		int prev_level = hal_queue_seeklevel(queue, level);
-		HALNode * prev;
-		while( prev_level != -1 ) {
-			// is the previous level node the tail?
-			prev = _interrupt_node[prev_level];
-			if( queue->tail == prev ) {
-				// clear the pipe entry from the table (but not the node)
-				_interrupt_queue[prev_level] = null;
-				// go around again with the next level down
-				prev_level = hal_queue_seeklevel(queue, level);
-			} else break;
-		}
-		// are we left with the simple case of no previous active levels?
-		if( prev_level == -1 ) {
-			// catch the pipe's tail, and link ourselves to the end
-			HALNode * last = hal_chain_follow(queue->tail);
-			last->next = node;
-			// update the pipe tail, now that we can catch ours
-			last = hal_chain_follow(node);
-			_interrupt_node[level] = last;
-			queue->tail = last;
-			// higher level interrupts may now clear our level
-		} else {
-			// has the previous level linked itself into a chain yet?
-			HALNode * anchor = hal_chain_anchor(queue,prev, prev_level);
-			HALNode * link;
-			HALNode * last;
-			if( anchor == null ) {
-				// stalled. replace the previous levels' chain
-				link = prev->next;
-				prev->next = node;
-				// catch our tail and link to the old chain
-				last = hal_chain_follow(node);
-				last->next = link;
-				// the lower continuance will catch our appended nodes
-			} else {
-				// anchored. replace the existing chain following the anchor node
-				link = anchor->next;
-				anchor->next = node;
-				// we are now reachable. catch our own tail, and link the chain
-				last = hal_chain_follow(node);
-				last->next = link;
-				// can we pre-update the pipe tail? (optional, but useful)
-				if( anchor == queue->tail ) {
-					_interrupt_node[level] = last;
-					queue->tail = last;
-				}
-			}
-		}
-		// clear the global level entries, during which the tail may move past us
-		_interrupt_queue[level] = null;
-		_interrupt_node[level] = null;
+	// read a link an interrupt might be writing. (a pointer is two bytes, so it could tear)
+	static HALNode * hal_link(HALNode * node) {
+		byte sreg = SREG;
+		cli();
+		HALNode * next = node->next;
+		SREG = sreg;
+		return next;
 	}
 
 	static HALNode * hal_queue_dequeue(HALQueue * queue, HALNode * sentinel) {
 		while(true) {
-			// get the head and tail of the queue and the head's next
+			// get the head of the queue and the head's next
 			HALNode * head = queue->head;
-			HALNode * tail = queue->tail;
-			HALNode * next = head->next;
-			// return null if the pipe has only one proper node
-			if(head == tail) return null;
+			HALNode * next = hal_link(head);
+			// return null if the queue is empty, or the next link hasn't been made yet
 			if(next == null) return null;
 			// we have a new queue head
 			queue->head = next;    
@@ -157,7 +106,7 @@ private:
 			// was it the sentinel?
 			if(head == sentinel) {
 				// recycle the sentinel
-				hal_queue_enqueue(queue, sentinel);
+				hal_queue_enqueue(queue, sentinel, sentinel);
 				// loop around again
 			} else {
 				// we have dequeued the entry sucessfully
@@ -166,12 +115,213 @@ private:
 		}
 	}
 
+	static HALNode * hal_queue_dequeue_all(HALQueue * queue, HALNode * sentinel) {
+		HALNode * first = queue->head;
+		if(first == sentinel) {
+			// step over the sentinel, and recycle it to the tail. it then marks the end of the batch.
+			first = hal_link(sentinel);
+			if(first == null) return null;
+			sentinel->next = null;
+			hal_queue_enqueue(queue, sentinel, sentinel);
+		}
+		// otherwise the sentinel is already further along, from an earlier dequeue(), and
+		// the batch ends there instead. the links up to it were all made before it was enqueued.
+		// either way the queue now starts again from the sentinel.
+		queue->head = sentinel;
+		return first;
+	}
+
 #undef null
 };
 
-byte HALQueue::_interrupt_level = 0;
-HALQueue * HALQueue::_interrupt_queue[16] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
-HALNode * HALQueue::_interrupt_node[16] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
+
+/*
+  ByteRing is a single-producer, single-consumer ring of bytes, for handing received bytes from an
+  interrupt to the main loop without either side ever disabling interrupts. The producer only
+  writes 'head' and the consumer only writes 'tail', and since both are single bytes, every
+  update is atomic on the AVR.
+
+  The size must be a power of two, up to 256, and the ring holds one less than that. When it's
+  full, push() drops the byte and counts it in 'dropped'.
+
+    byte rx_storage[64];
+    ByteRing rx(rx_storage, 64);
+    ISR(USART1_RX_vect) { rx.push(UDR1); }
+
+  (The core's HardwareSerial also wants that vector, so you can't use Serial1 as well.)
+ */
+class ByteRing {
+private:
+	volatile byte * buffer;
+	byte mask;
+	volatile byte head; // next byte to write - only the producer changes this
+	volatile byte tail; // next byte to read - only the consumer changes this
+	bool owned; // did we allocate the buffer?
+public:
+	volatile word dropped;
+
+	// constructor - use the caller's storage
+	ByteRing(byte * storage, word size) {
+		buffer = storage;
+		owned = false;
+		mask = size - 1;
+		head = 0;
+		tail = 0;
+		dropped = 0;
+	}
+	// constructor - storage from the heap (once)
+	ByteRing(word size) {
+		buffer = new byte[size];
+		owned = true;
+		mask = size - 1;
+		head = 0;
+		tail = 0;
+		dropped = 0;
+	}
+	~ByteRing() {
+		if(owned) delete[] buffer;
+	}
+
+	// producer side. false if the ring was full.
+	bool push(byte b) {
+		byte h = head;
+		byte n = (h + 1) & mask;
+		if(n == tail) {
+			dropped++;
+			return false;
+		}
+		buffer[h] = b;
+		head = n;
+		return true;
+	}
+
+	// consumer side
+	byte count() { return (head - tail) & mask; }
+	byte capacity() { return mask; }
+	bool empty() { return head == tail; }
+	// the byte 'offset' places from the front, without removing it
+	byte peek(byte offset) { return buffer[(byte)(tail + offset) & mask]; }
+	// remove one byte, or -1 if there wasn't one
+	int pop() {
+		byte t = tail;
+		if(t == head) return -1;
+		byte b = buffer[t];
+		tail = (t + 1) & mask;
+		return b;
+	}
+	// remove several bytes at once
+	void skip(byte n) { tail = (byte)(tail + n) & mask; }
+	// where the front is, for making views of the ring contents
+	byte front() { return tail; }
+	byte at(byte index) { return buffer[index & mask]; }
+};
+
+
+/*
+  HALRing is the general version of ByteRing: a bounded single-producer, single-consumer ring of
+  any small type, such as packet descriptors or pulse timings, between an interrupt and the main
+  loop. Neither side ever disables interrupts or walks a list - push() and pop() are a few
+  instructions, always.
+
+  SIZE must be a power of two, up to 128, and the ring holds all SIZE entries. The two indexes
+  run freely and are only masked when used, which is why SIZE has to divide 256. Each side only
+  writes its own index, and each index is a single byte, so every update is atomic on the AVR.
+
+  An entry is copied in (or out) before the index that hands it over is written, with a compiler
+  barrier in between so the optimizer can't reorder them. Entries that won't fit are dropped and
+  counted - 'dropped' is written by the producer only, so read it with interrupts off if you need
+  an exact figure.
+
+    struct Pulse { word width; byte level; };
+    HALRing<Pulse, 32> pulses;
+    ISR(INT0_vect) { Pulse p = { TCNT1, PIND & 1 }; pulses.push(p); }
+    void loop() { Pulse batch[8]; byte n = pulses.drain(batch, 8); ... }
+
+  The producer can also fill an entry in place, with claim() and publish().
+ */
+template <class T, byte SIZE> class HALRing {
+private:
+	T buffer[SIZE];
+	volatile byte head; // entries written - only the producer changes this
+	volatile byte tail; // entries read - only the consumer changes this
+	// keep the compiler from moving entry copies past the index updates
+	static inline void barrier() { __asm__ __volatile__ ("" ::: "memory"); }
+public:
+	volatile word dropped;
+
+	// constructor
+	HALRing() {
+		head = 0;
+		tail = 0;
+		dropped = 0;
+	}
+
+	// producer side. false (and counted) if the ring was full.
+	bool push(const T & entry) {
+		byte h = head;
+		if((byte)(h - tail) == SIZE) {
+			dropped++;
+			return false;
+		}
+		buffer[h & (SIZE-1)] = entry;
+		barrier();
+		head = h + 1;
+		return true;
+	}
+	// producer side, in place. the free entry to fill, or zero (and counted) if full.
+	T * claim() {
+		byte h = head;
+		if((byte)(h - tail) == SIZE) {
+			dropped++;
+			return 0;
+		}
+		return &buffer[h & (SIZE-1)];
+	}
+	// hand over the entry that claim() returned
+	void publish() {
+		barrier();
+		head = head + 1;
+	}
+
+	// consumer side
+	byte count() { return head - tail; }
+	byte capacity() { return SIZE; }
+	bool empty() { return head == tail; }
+	bool full() { return (byte)(head - tail) == SIZE; }
+	// the front entry, without removing it, or zero if empty
+	T * peek() {
+		byte t = tail;
+		if(t == head) return 0;
+		return &buffer[t & (SIZE-1)];
+	}
+	// remove the front entry. false if there wasn't one.
+	bool pop(T * entry) {
+		byte t = tail;
+		if(t == head) return false;
+		*entry = buffer[t & (SIZE-1)];
+		barrier();
+		tail = t + 1;
+		return true;
+	}
+	// remove up to 'max' entries at once, with a single index update. returns how many.
+	byte drain(T * entries, byte max) {
+		byte t = tail;
+		byte n = head - t;
+		if(n > max) n = max;
+		for(byte i=0; i<n; i++) entries[i] = buffer[(byte)(t + i) & (SIZE-1)];
+		barrier();
+		tail = t + n;
+		return n;
+	}
+	// throw away up to 'n' entries, such as after peek()
+	void skip(byte n) {
+		byte t = tail;
+		byte c = head - t;
+		if(n > c) n = c;
+		barrier();
+		tail = t + n;
+	}
+};
 
 
 #endif
\ No newline at end of file
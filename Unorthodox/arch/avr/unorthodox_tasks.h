@@ -0,0 +1,247 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+ */
+
+#ifndef UNORTHODOX_TASKS_H
+#define UNORTHODOX_TASKS_H
+
+/*
+  A Task is a piece of work the Scheduler runs from the main loop, either every so many
+  milliseconds, once after a delay, or as soon as possible after being posted (which is safe
+  to do from an interrupt). Subclasses just implement run().
+
+  Each task keeps its own accounts, so you can see where the time is going:
+    runs         - how many times it has run
+    run_micros   - total time spent in run()
+    worst_micros - the longest single run
+    worst_late   - the furthest behind schedule it has started, in milliseconds (the jitter)
+ */
+class Task : public HALNode {
+public:
+	// schedule
+	unsigned long due;      // millis() when it should next run
+	word period;            // milliseconds between runs, or zero for one-shot
+	unsigned long last_run; // millis() when it last ran
+	// accounts
+	unsigned long runs;
+	unsigned long run_micros;
+	word worst_micros;
+	word worst_late;
+	// scheduler state
+	byte heap_index;        // where it is in the scheduler's heap
+	volatile bool posted;   // waiting in the post queue
+	static const byte NOT_SCHEDULED = 0xFF;
+
+	// constructor
+	Task() {
+		next = 0;
+		due = 0;
+		period = 0;
+		last_run = 0;
+		heap_index = NOT_SCHEDULED;
+		posted = false;
+		clear_accounts();
+	}
+	void clear_accounts() {
+		runs = 0;
+		run_micros = 0;
+		worst_micros = 0;
+		worst_late = 0;
+	}
+	bool scheduled() { return heap_index!=NOT_SCHEDULED; }
+
+	// do the work. dt is the milliseconds since the last run (capped at 32767)
+	virtual void run(int dt) = 0;
+};
+
+/*
+  A task that just calls a function, for sensor sampling and the like.
+ */
+class FunctionTask : public Task {
+private:
+	void (*function)(int dt);
+public:
+	// constructor
+	FunctionTask(void (*function)(int dt)) {
+		this->function = function;
+	}
+	void run(int dt) { function(dt); }
+};
+
+/*
+  Scheduler is a cooperative task runner: call run() from loop() and it runs whatever is due.
+  Timed tasks are kept in a binary heap ordered by due time, so finding the next one is free and
+  rescheduling is a few swaps, however many tasks there are. Due times are compared with wrap-around
+  arithmetic, so millis() rolling over after 49 days doesn't matter.
+
+  A periodic task is rescheduled from its due time, not from when it actually ran, so it doesn't
+  drift. If it falls more than a whole period behind, the missed runs are skipped rather than
+  run back-to-back.
+
+  post() hands a task over from an interrupt through a HALQueue, and it's run on the next pass.
+  Posting a task that's already waiting does nothing.
+
+    class PingTask : public Task { void run(int dt) { ranger_pulse(); } } ping;
+    Scheduler tasks(8);
+    void setup() { tasks.every(&ping, 100); }
+    void loop() { tasks.run(); }
+ */
+class Scheduler {
+private:
+	Task ** heap;
+	byte count;
+	byte capacity;
+	HALQueue posts;
+
+	// wrap-around safe 'a is before b'
+	static bool before(unsigned long a, unsigned long b) { return (long)(a - b) < 0; }
+
+	void heap_set(byte i, Task * t) {
+		heap[i] = t;
+		t->heap_index = i;
+	}
+	// (child and parent are words, since 2i+1 overflows a byte once i reaches 128)
+	void heap_up(byte i) {
+		Task * t = heap[i];
+		while(i>0) {
+			word parent = (i-1)/2;
+			if(!before(t->due, heap[parent]->due)) break;
+			heap_set(i, heap[parent]);
+			i = parent;
+		}
+		heap_set(i, t);
+	}
+	void heap_down(byte i) {
+		Task * t = heap[i];
+		while(true) {
+			word child = i*2+1;
+			if(child>=count) break;
+			if((child+1<count) && before(heap[child+1]->due, heap[child]->due)) child++;
+			if(!before(heap[child]->due, t->due)) break;
+			heap_set(i, heap[child]);
+			i = child;
+		}
+		heap_set(i, t);
+	}
+	void heap_remove(byte i) {
+		Task * t = heap[i];
+		t->heap_index = Task::NOT_SCHEDULED;
+		count--;
+		if(i==count) return;
+		// fill the hole with the last entry, which might need to go either way
+		Task * last = heap[count];
+		heap_set(i, last);
+		heap_down(i);
+		heap_up(last->heap_index);
+	}
+
+	// run a task, and keep its accounts
+	void execute(Task * t, unsigned long now) {
+		unsigned long elapsed = now - t->last_run;
+		int dt = (elapsed & 0xffff8000) ? 0x7fff : elapsed;
+		t->last_run = now;
+		unsigned long start = micros();
+		t->run(dt);
+		unsigned long took = micros() - start;
+		t->runs++;
+		t->run_micros += took;
+		if(took > t->worst_micros) t->worst_micros = (took > 0xffff) ? 0xffff : took;
+	}
+public:
+	// constructor. at most 254 tasks, since a heap_index of 255 means 'not scheduled'.
+	Scheduler(byte capacity) {
+		if(capacity > Task::NOT_SCHEDULED - 1) capacity = Task::NOT_SCHEDULED - 1;
+		this->capacity = capacity;
+		heap = new Task*[capacity];
+		count = 0;
+	}
+
+	// run the task every 'period' ms, starting after 'delay' ms. false if there's no room.
+	bool every(Task * t, word period, word delay) {
+		t->period = period;
+		return at(t, delay);
+	}
+	bool every(Task * t, word period) { return every(t, period, period); }
+	// run the task once, after 'delay' ms. (or reschedule it, if it's already waiting)
+	bool after(Task * t, word delay) {
+		t->period = 0;
+		return at(t, delay);
+	}
+	// stop running a task
+	void cancel(Task * t) {
+		if(t->scheduled()) heap_remove(t->heap_index);
+	}
+
+	// hand a task over to be run as soon as possible. safe from interrupts.
+	void post(Task * t) {
+		byte sreg = SREG;
+		cli();
+		bool waiting = t->posted;
+		t->posted = true;
+		SREG = sreg;
+		if(!waiting) {
+			t->next = 0;
+			posts.enqueue(t);
+		}
+	}
+
+	// run everything that's due. call this from loop()
+	void run() {
+		unsigned long now = millis();
+		// posted tasks first, as one batch
+		HALNode * node = posts.dequeue_all();
+		while(node) {
+			Task * t = (Task *)node;
+			// step on before running it, since it might post itself again
+			node = posts.batch_next(node);
+			t->posted = false;
+			execute(t, now);
+		}
+		// then the timed ones
+		while(count && !before(now, heap[0]->due)) {
+			Task * t = heap[0];
+			word late = (now - t->due > 0xffff) ? 0xffff : now - t->due;
+			if(late > t->worst_late) t->worst_late = late;
+			if(t->period) {
+				// next slot, skipping any we've completely missed
+				t->due += t->period;
+				if(!before(now, t->due)) t->due = now + t->period;
+				heap_down(0);
+			} else {
+				heap_remove(0);
+			}
+			execute(t, now);
+		}
+	}
+
+	// milliseconds until the next timed task is due (zero if it already is), or 0xffff if none
+	word idle() {
+		if(count==0) return 0xffff;
+		unsigned long now = millis();
+		if(!before(now, heap[0]->due)) return 0;
+		unsigned long wait = heap[0]->due - now;
+		return (wait > 0xffff) ? 0xffff : wait;
+	}
+	byte size() { return count; }
+	Task * get(byte i) { return heap[i]; }
+
+private:
+	bool at(Task * t, word delay) {
+		unsigned long now = millis();
+		t->due = now + delay;
+		if(t->last_run==0) t->last_run = now;
+		if(t->scheduled()) {
+			// move it
+			heap_down(t->heap_index);
+			heap_up(t->heap_index);
+			return true;
+		}
+		if(count>=capacity) return false;
+		heap_set(count, t);
+		count++;
+		heap_up(count-1);
+		return true;
+	}
+};
+
+#endif
@@ -197,30 +197,79 @@ public:
   necessary to allow a primitive but fast form of 'polymorphism', so the 
   same code path can manage trees of radically different structures. 
 
+  The algorithms live in RedBlackCore, which takes the class that provides
+  the node accessors as a template parameter. That class can make them
+  plain inline (or static) methods, and a whole insert or remove then runs
+  without a single indirect call - at the cost of one more copy of the
+  algorithms in flash for each tree type. RedBlackTree is the virtual
+  flavour, where every tree type shares one copy and pays a call per link.
+
+  A policy can also keep a summary in each node that depends on the shape of
+  the subtree below it - the subtree node count being the useful one, which
+  gives rank and select in log(n). It sets 'augmented', and provides
+  augment(node) to recompute a node's summary from its two children, and
+  augment_swap(x,y) to trade summaries when exchange_nodes() swaps two nodes'
+  positions. The algorithms then call them wherever the shape changes. Plain
+  trees leave 'augmented' false and the hooks compile away.
+
  */
 
 
 
-class RedBlackTree {
+template <class Policy> class RedBlackCore {
 private:
-	// abstract methods that must be provided by real implementations
-	virtual word parent(word node) = 0;
-	virtual word left(word node) = 0;
-	virtual word right(word node) = 0;
-	virtual bool is_red(word node) = 0;
-
-	virtual void set_parent(word node, word link) = 0;
-	virtual void set_left(word node, word link) = 0;
-	virtual void set_right(word node, word link) = 0;
-	virtual void set_red(word node) = 0;
-	virtual void set_black(word node) = 0;
-	// virtual static void set_color(word node, bool red) = 0;
+	// forward the node accessors to the policy class, which must provide every one of these.
+	// They are resolved at compile time, so simple accessors inline straight into the algorithms.
+	Policy * policy() { return static_cast<Policy *>(this); }
+
+	word parent(word node) { return policy()->parent(node); }
+	word left(word node) { return policy()->left(node); }
+	word right(word node) { return policy()->right(node); }
+	bool is_red(word node) { return policy()->is_red(node); }
+
+	void set_parent(word node, word link) { policy()->set_parent(node, link); }
+	void set_left(word node, word link) { policy()->set_left(node, link); }
+	void set_right(word node, word link) { policy()->set_right(node, link); }
+	void set_red(word node) { policy()->set_red(node); }
+	void set_black(word node) { policy()->set_black(node); }
+
+	word tree_root() { return policy()->tree_root(); }
+	void set_root(word node) { policy()->set_root(node); }
+
+	int node_compare(word lnode, word rnode) { return policy()->node_compare(lnode, rnode); }
+	int key_compare(word lnode, word rkey) { return policy()->key_compare(lnode, rkey); }
+
+	// recompute the summaries on the path from a node up to the root
+	void augment_path(word node) {
+		while(node != null) {
+			policy()->augment(node);
+			node = parent(node);
+		}
+	}
 
-	virtual word tree_root() = 0;
-	virtual void set_root(word node) = 0;
+	// build a balanced subtree from the next 'count' nodes of the list, recursively
+	word build_subtree(word * list, word count, byte depth, byte red_depth) {
+		if(count == 0) return null;
+		// half (rounded down) of the rest go on the left, so the two sides never differ by more than one
+		word lcount = (count - 1) >> 1;
+		word l = build_subtree(list, lcount, depth + 1, red_depth);
+		word node = *list;
+		*list = right(node);
+		word r = build_subtree(list, count - 1 - lcount, depth + 1, red_depth);
+		set_left(node, l);
+		if(l != null) set_parent(l, node);
+		set_right(node, r);
+		if(r != null) set_parent(r, node);
+		if(depth == red_depth) { set_red(node); } else { set_black(node); }
+		if(Policy::augmented) policy()->augment(node);
+		return node;
+	}
 
-	virtual int node_compare(word lnode, word rnode) = 0;
-	virtual int key_compare(word lnode, word rkey) = 0;
+protected:
+	// default (empty) augmentation hooks. Policies that set 'augmented' hide these with their own.
+	static const bool augmented = false;
+	void augment(word node) { }
+	void augment_swap(word x, word y) { }
 
 public:  
 	typedef word NodeView;
@@ -327,6 +376,7 @@ public:
 		if( n == null ) {
 			// this becomes the root node.
 			set_root(node);
+			if(Policy::augmented) policy()->augment(node);
 			// which is colored black
 			set_black(node);
 			// all done
@@ -346,6 +396,7 @@ public:
 						// insert the new terminal node to the left
 						set_left(n, node);
 						set_parent(node, n);
+						if(Policy::augmented) augment_path(node);
 						balance_postinsert(node);
 						return null; // no conflicts
 					} else  n = cn;
@@ -356,6 +407,7 @@ public:
 						// insert the new terminal node to the right
 						set_right(n, node); 
 						set_parent(node, n);
+						if(Policy::augmented) augment_path(node);
 						balance_postinsert(node);
 						return null; // no conflicts
 					} else  n = cn;
@@ -483,11 +535,16 @@ public:
 		if(sub == null) {
 			// balance the tree before we remove this terminal node.
 			if(!is_red(node)) { balance_postdelete( node ); }
+			// (the balancing may have moved it, so look up the parent afterwards)
+			NodeView p = parent(node);
 			replace_node( node,null );
+			if(Policy::augmented) augment_path(p);
 		} else {
 			// balance the tree from the node that remains
 			replace_node( node,sub );
-			if(!is_red(sub)) { balance_postdelete( sub ); }
+			if(Policy::augmented) augment_path(parent(sub));
+			// a lone red child just takes over the black of the node it replaced
+			if(is_red(sub)) { set_black( sub ); } else { balance_postdelete( sub ); }
 		}
 		// unreference node pointers.
 		set_parent(node, null); 
@@ -505,7 +562,7 @@ public:
 	void balance_postdelete(NodeView node) {
 		NodeView n = null;
 		// iterate while we are black, until we are at the current root
-		while( (node!=null) && !is_red( node ) ) {
+		while( (node!=null) && (node!=tree_root()) && !is_red( node ) ) {
 			NodeView p = parent(node);
 			NodeView sib_left = left(p); 
 			NodeView sib_right = right(p); 
@@ -589,6 +646,8 @@ public:
 				}
 			}
 		}
+		// if we stopped on a red node, it absorbs the missing black
+		if(node!=null) { set_black( node ); }
 		// colour the root node to black
 		node = tree_root();
 		if(node!=null) { set_black( node ); }
@@ -649,6 +708,95 @@ public:
 		} else {
 			if(is_red(y)) { set_red(x); set_black(y); }
 		}    
+		// summaries belong to the position, not the node
+		if(Policy::augmented) policy()->augment_swap(x, y);
+	}
+
+	/*
+      Bulk operations. These work on 'lists' of nodes - a chain in ascending order linked through
+      the right links, ending in null - which is what a tree can be cheaply flattened into, and
+      what a tree can be built straight from, without any compares or rebalancing.
+	 */
+
+	/*
+      Build the tree from a list of 'count' nodes, which must already be in strictly ascending
+      order. Whatever the tree held before is forgotten. The shape is as balanced as it can be,
+      with only the nodes on the last (incomplete) level coloured red.
+        time: n
+	 */
+	void tree_build(NodeView list, word count) {
+		// how many complete levels will there be? the nodes below those are the red ones.
+		byte red_depth = 0;
+		word c = count + 1;
+		while(c > 1) { c >>= 1; red_depth++; }
+		NodeView root = build_subtree(&list, count, 0, red_depth);
+		if(root != null) set_parent(root, null);
+		set_root(root);
+	}
+
+	/*
+      Take apart the tree, leaving it empty, and return its nodes as an ascending list.
+      Walking backwards means each node's right link has already been used by the time we
+      reuse it, and tree_prev_node() only needs the left and parent links.
+        time: n
+	 */
+	NodeView tree_flatten(word * count) {
+		NodeView list = null;
+		word n = 0;
+		NodeView node = tree_root();
+		if(node != null) node = rightmost(node);
+		while(node != null) {
+			NodeView prev = tree_prev_node(node);
+			set_right(node, list);
+			list = node;
+			node = prev;
+			n++;
+		}
+		set_root(null);
+		if(count) *count = n;
+		return list;
+	}
+
+	/*
+      Move every node of another tree (of the same type) into this one. Where both trees have
+      the key, our node is kept and theirs is left behind; 'other' ends up holding just those
+      duplicates. Returns how many there were.
+        time: n + m
+	 */
+	word tree_merge(RedBlackCore<Policy> * other) {
+		word count = 0;
+		NodeView a = tree_flatten(&count);
+		NodeView b = other->tree_flatten(0);
+		NodeView head = null, tail = null;
+		NodeView dups = null, dups_tail = null;
+		word dup_count = 0;
+		// ordinary merge of two sorted lists
+		while(b != null) {
+			NodeView take;
+			int r = (a == null) ? 1 : node_compare(a, b);
+			if(r > 0) {
+				// theirs is next
+				take = b; b = right(b);
+				count++;
+			} else {
+				if(r == 0) {
+					// same key. put theirs aside
+					NodeView d = b; b = right(b);
+					set_right(d, null);
+					if(dups_tail == null) dups = d; else set_right(dups_tail, d);
+					dups_tail = d;
+					dup_count++;
+				}
+				take = a; a = right(a);
+			}
+			if(tail == null) head = take; else set_right(tail, take);
+			tail = take;
+		}
+		// the rest of ours is already in order
+		if(tail == null) head = a; else set_right(tail, a);
+		tree_build(head, count);
+		other->tree_build(dups, dup_count);
+		return dup_count;
 	}
 
 	/*
@@ -698,6 +846,8 @@ public:
 		// Finally, put X on Y's left
 		set_left(y, x); 
 		set_parent(x, y);
+		// X is now below Y, so it gets recomputed first
+		if(Policy::augmented) { policy()->augment(x); policy()->augment(y); }
 	}
 
 	/*
@@ -728,6 +878,7 @@ public:
 		// Finally, put x on y's right
 		set_right(y, x);
 		set_parent(x, y);
+		if(Policy::augmented) { policy()->augment(x); policy()->augment(y); }
 	}
 
 
@@ -737,8 +888,37 @@ public:
 		while(indent-- > 0) Serial.print("  ");
 	}
 
-	virtual void node_print(int indent, word node) =0;
+};
+
+/*
+  The original 'polymorphic' tree. Every accessor is a virtual call, but all descendants
+  share the one compiled copy of the algorithms. Subclass this when you have several
+  different tree types and flash space matters more than speed.
+ */
+class RedBlackTree : public RedBlackCore<RedBlackTree> {
+	friend class RedBlackCore<RedBlackTree>;
+private:
+	// abstract methods that must be provided by real implementations
+	virtual word parent(word node) = 0;
+	virtual word left(word node) = 0;
+	virtual word right(word node) = 0;
+	virtual bool is_red(word node) = 0;
+
+	virtual void set_parent(word node, word link) = 0;
+	virtual void set_left(word node, word link) = 0;
+	virtual void set_right(word node, word link) = 0;
+	virtual void set_red(word node) = 0;
+	virtual void set_black(word node) = 0;
+	// virtual static void set_color(word node, bool red) = 0;
+
+	virtual word tree_root() = 0;
+	virtual void set_root(word node) = 0;
 
+	virtual int node_compare(word lnode, word rnode) = 0;
+	virtual int key_compare(word lnode, word rkey) = 0;
+
+public:
+	virtual void node_print(int indent, word node) =0;
 
 };
 
@@ -769,41 +949,202 @@ struct MapNode {
 };
 
 /*
+  MapPool is a fixed-capacity arena of map nodes. All the storage is claimed once (either from
+  the heap at construction, or from a buffer you provide) and after that nodes are handed out
+  and taken back in constant time, without going anywhere near malloc() or free().
+
+  Free nodes are kept on a list threaded through their 'parent' link, since a node that isn't
+  in a tree has no use for it. The node size is a parameter so that descendants of MapNode
+  (with payload fields tacked on the end) can be pooled just as easily:
+
+    struct SignalNode : public MapNode { int value; };
+    MapPool pool(sizeof(SignalNode), 32);
+    Map map(&pool);
+    SignalNode * n = (SignalNode *)map.insert(42);
+
+  'used' and 'high_water' count the live nodes and the most that have ever been live at once,
+  which is handy for sizing the pool to the real load rather than a guess.
+ */
+class MapPool {
+private:
+	byte * storage;
+	bool storage_owned;
+	word node_size;
+	word free_list;
+public:
+	word capacity;
+	word used;
+	word high_water;
+
+	// constructor - take the storage from the heap (once)
+	MapPool(word size, word count) {
+		// every node has to hold at least a MapNode
+		if(size < sizeof(MapNode)) size = sizeof(MapNode);
+		storage = new byte[size * count];
+		storage_owned = true;
+		node_size = size;
+		capacity = count;
+		reset();
+	}
+	// constructor - use caller storage, which must be at least size*count bytes
+	MapPool(void * buffer, word size, word count) {
+		storage = (byte *)buffer;
+		storage_owned = false;
+		// a size too small for a MapNode gets fewer, full-sized nodes out of the same buffer
+		if(size < sizeof(MapNode)) {
+			count = (size * count) / sizeof(MapNode);
+			size = sizeof(MapNode);
+		}
+		node_size = size;
+		capacity = count;
+		reset();
+	}
+	~MapPool() {
+		if(storage_owned) delete[] storage;
+	}
+
+	// return every node to the free list. Any map still using them is invalidated.
+	void reset() {
+		free_list = 0;
+		// thread the list backwards, so nodes are handed out in storage order
+		word i = capacity;
+		while(i-- > 0) {
+			MapNode * n = (MapNode *)(storage + i * node_size);
+			n->parent = free_list;
+			free_list = (word)n;
+		}
+		used = 0;
+		high_water = 0;
+	}
+
+	// take a cleared node from the pool, or null if it is exhausted
+	MapNode * alloc() {
+		MapNode * n = (MapNode *)free_list;
+		if(n) {
+			free_list = n->parent;
+			n->parent = 0;
+			n->left = 0;
+			n->right = 0;
+			n->meta = 0;
+			if(++used > high_water) high_water = used;
+		}
+		return n;
+	}
+
+	// give a node back to the pool. It must have come from this pool, and be out of any tree.
+	void free(MapNode * node) {
+		node->parent = free_list;
+		free_list = (word)node;
+		used--;
+	}
+
+	// does this node live within our storage?
+	bool owns(MapNode * node) {
+		byte * b = (byte *)node;
+		return (b >= storage) && (b < storage + capacity * node_size);
+	}
+};
+
+/*
+  MapRange walks the keys between two bounds (inclusive) in order. It keeps its own stack of
+  the ancestors still to be visited, so each step is a pop and a short run down a left edge,
+  instead of the climb back through the parent links that next() has to do.
+
+  A Map's height is at most twice log2 of its size, and with 15-bit keys that is never more
+  than 30, so the stack can't overflow.
 
+    MapRange r;
+    map.range(&r, 100, 200);
+    for(MapNode * n = r.next(); n; n = r.next()) { ... }
  */
-class Map: public RedBlackTree {
+class MapRange {
 private:
+	MapNode * stack[32];
+	byte depth;
+	word hi;
+
+	// stack this node and its left descendants, the next ones to be visited
+	void descend(MapNode * node) {
+		while(node) {
+			stack[depth++] = node;
+			node = (MapNode *)node->left;
+		}
+	}
+public:
+	MapRange() {
+		depth = 0;
+	}
+
+	// start a walk over the keys lo..hi in the tree under 'root'
+	void begin(MapNode * root, word lo, word hi) {
+		this->hi = hi;
+		depth = 0;
+		// go down towards lo, remembering every node at or after it (the ones we went left at)
+		MapNode * node = root;
+		while(node) {
+			if(node->get_key() >= lo) {
+				stack[depth++] = node;
+				node = (MapNode *)node->left;
+			} else {
+				node = (MapNode *)node->right;
+			}
+		}
+	}
+
+	// the next node in the range, or null when we're past the end
+	MapNode * next() {
+		if(depth==0) return 0;
+		MapNode * node = stack[--depth];
+		if(node->get_key() > hi) {
+			depth = 0;
+			return 0;
+		}
+		descend((MapNode *)node->right);
+		return node;
+	}
+};
+
+/*
+  The common body of Map and CountedMap. Policy is the final map class, which is what the tree
+  algorithms call back into; these accessors work for any node that starts with a MapNode.
+ */
+template <class Policy> class MapCore: public RedBlackCore<Policy> {
+	friend class RedBlackCore<Policy>;
+	typedef RedBlackCore<Policy> Tree;
+protected:
 	word root;
+	MapPool * pool;
 
-	// abstract methods that must be provided by real implementations
-	virtual word parent(word node) { return ((MapNode *)node)->parent; }
-	virtual word left(word node) { return ((MapNode *)node)->left; }
-	virtual word right(word node) { return ((MapNode *)node)->right; }
-	virtual bool is_red(word node) { return (((MapNode *)node)->meta & 0x8000)!=0; }
+	// node accessors for the tree algorithms. These are static and inline, so the
+	// algorithms compile down to direct field access on the MapNode structure.
+	static word parent(word node) { return ((MapNode *)node)->parent; }
+	static word left(word node) { return ((MapNode *)node)->left; }
+	static word right(word node) { return ((MapNode *)node)->right; }
+	static bool is_red(word node) { return (((MapNode *)node)->meta & 0x8000)!=0; }
 
-	virtual void set_parent(word node, word link) { ((MapNode *)node)->parent = link; }
-	virtual void set_left(word node, word link)  { ((MapNode *)node)->left = link; }
-	virtual void set_right(word node, word link)  { ((MapNode *)node)->right = link; }
-	virtual void set_red(word node)  { ((MapNode *)node)->meta |= 0x8000; }
-	virtual void set_black(word node)  { ((MapNode *)node)->meta &= 0x7FFF; }
+	static void set_parent(word node, word link) { ((MapNode *)node)->parent = link; }
+	static void set_left(word node, word link)  { ((MapNode *)node)->left = link; }
+	static void set_right(word node, word link)  { ((MapNode *)node)->right = link; }
+	static void set_red(word node)  { ((MapNode *)node)->meta |= 0x8000; }
+	static void set_black(word node)  { ((MapNode *)node)->meta &= 0x7FFF; }
 
-	virtual word tree_root() { return root; }
-	virtual void set_root(word node) { root = node; }
+	word tree_root() { return root; }
+	void set_root(word node) { root = node; }
 
-	virtual int node_compare(word lnode, word rnode) {   
+	static int node_compare(word lnode, word rnode) {   
 		word lkey = ((MapNode *)lnode)->meta & 0x7FFF;
 		word rkey = ((MapNode *)rnode)->meta & 0x7FFF;
 		return lkey - rkey;
 	};
 
-	virtual int key_compare(word lnode, word rkey) {
+	static int key_compare(word lnode, word rkey) {
 		word lkey = ((MapNode *)lnode)->meta & 0x7FFF;
 		return lkey - rkey;
 	};
 
-	virtual void node_print(int indent, word node) {
-		indent_print(indent);
-		if(node==null) {
+	void node_print(int indent, word node) {
+		this->indent_print(indent);
+		if(node==0) {
 			Serial.print("[empty]\n");
 		} else {
 			Serial.print("[node "); Serial.print(node);
@@ -816,37 +1157,436 @@ private:
 		}
 	}
 
-public:
-	Map() {
-		// clear root node
+	MapCore(MapPool * pool) {
+		// clear root node, and remember where our nodes come from (if anywhere)
 		root = 0;
+		this->pool = pool;
 	}
+
+	// dispose of a node that's out of the tree. pooled nodes go back where they came from,
+	// and only new'd ones get deleted.
+	void release(MapNode * node) {
+		if(pool && pool->owns(node)) pool->free(node);
+		else delete node;
+	}
+
+public:
 	MapNode * seek(word key, int match) {
-		return (MapNode *)tree_seek_node(key, match); 
+		return (MapNode *)this->tree_seek_node(key, match); 
 	}
 	MapNode * seek(word key) {
-		return (MapNode *)tree_seek_node(key, MATCH_EXACT); 
+		return (MapNode *)this->tree_seek_node(key, Tree::MATCH_EXACT); 
 	}
 	word add(MapNode * node) {
-		return tree_insert_node((word)node);
+		return this->tree_insert_node((word)node);
 	}
 	word rm(MapNode * node) {
-		tree_remove_node((word)node);
+		this->tree_remove_node((word)node);
+		return (word)node;
 	}
 	bool rm(word key) {
-		word node = tree_seek_node(key, MATCH_EXACT);
+		word node = this->tree_seek_node(key, Tree::MATCH_EXACT);
 		if(node) {
-			tree_remove_node(node);
-			delete (MapNode *)node;
+			this->tree_remove_node(node);
+			release((MapNode *)node);
 			return true;
 		}
 		return false;
 	}
 
-	MapNode * first() { return (root==null) ? null : (MapNode *)leftmost(root); }
-	MapNode * last() { return (root==null) ? null : (MapNode *)rightmost(root); }
-	MapNode * next(MapNode * node) { return (MapNode *)tree_next_node((NodeView)node); }
-	MapNode * prev(MapNode * node) { return (MapNode *)tree_prev_node((NodeView)node); }
+	/*
+	  Pooled versions of add and rm. insert() returns the node for the key, taking a fresh
+	  one from the pool if the key isn't already present. It returns null only if there is
+	  no pool, or the pool has run dry.
+	 */
+	MapNode * insert(word key) {
+		if(pool==0) return 0;
+		// look first, so an existing key is found even when the pool is empty
+		word existing = this->tree_seek_node(key, Tree::MATCH_EXACT);
+		if(existing) return (MapNode *)existing;
+		MapNode * node = pool->alloc();
+		if(node==0) return 0;
+		node->set_key(key);
+		this->tree_insert_node((word)node);
+		return node;
+	}
+	bool erase(word key) {
+		if(pool==0) return false;
+		word node = this->tree_seek_node(key, Tree::MATCH_EXACT);
+		if(node) {
+			this->tree_remove_node(node);
+			// (it may not be one of ours, if it came in through merge)
+			release((MapNode *)node);
+			return true;
+		}
+		return false;
+	}
+
+	MapNode * first() { return (root==0) ? 0 : (MapNode *)this->leftmost(root); }
+	MapNode * last() { return (root==0) ? 0 : (MapNode *)this->rightmost(root); }
+	MapNode * next(MapNode * node) { return (MapNode *)this->tree_next_node((word)node); }
+	MapNode * prev(MapNode * node) { return (MapNode *)this->tree_prev_node((word)node); }
+
+	/*
+	  Build the map from an array of nodes, which must be in strictly ascending key order, in
+	  linear time - much quicker than add()ing them one by one when restoring a saved map.
+	  The map must be empty to start with. Returns false (and changes nothing) if it isn't, or
+	  if the nodes are out of order.
+	 */
+	bool build(MapNode ** nodes, word count) {
+		// building over existing nodes would lose track of them
+		if(root) return false;
+		for(word i = 1; i < count; i++) {
+			if(nodes[i-1]->get_key() >= nodes[i]->get_key()) return false;
+		}
+		// thread them into a list through the right links
+		word list = 0;
+		word i = count;
+		while(i-- > 0) {
+			nodes[i]->right = list;
+			list = (word)nodes[i];
+		}
+		this->tree_build(list, count);
+		return true;
+	}
+
+	// move all of other's nodes into this map, in linear time. Where both maps have a key we
+	// keep ours, and theirs stays in 'other'. Returns how many of those there were.
+	// (the nodes don't change pools, so only merge maps which share one, or use new'd nodes)
+	word merge(Policy * other) {
+		return this->tree_merge(other);
+	}
+
+	// set up a MapRange to walk the keys lo..hi
+	void range(MapRange * r, word lo, word hi) {
+		r->begin((MapNode *)root, lo, hi);
+	}
+
+	void print() {
+		node_print(0,root);
+	}
+};
+
+/*
+  Map runs the tree algorithms through inline accessors, so it is no longer a RedBlackTree
+  itself. Code that takes a RedBlackTree * can be handed a MapTree over it instead.
+ */
+class Map: public MapCore<Map> {
+	friend class MapTree;
+public:
+	Map() : MapCore<Map>(0) { }
+	Map(MapPool * pool) : MapCore<Map>(pool) { }
+};
+
+/*
+  A RedBlackTree view of a Map, for code written against the virtual tree. The accessors
+  reach straight into the MapNodes and the map's root, so changes made through either one
+  show up in the other:
+
+    Map map(&pool);
+    MapTree tree(&map);
+    word node = tree.tree_seek_node(42, RedBlackTree::MATCH_EXACT);
+
+  Each link costs a virtual call again, which is the price of sharing the one copy of the
+  algorithms with the other RedBlackTree types.
+ */
+class MapTree: public RedBlackTree {
+private:
+	Map * map;
+
+	word parent(word node) { return Map::parent(node); }
+	word left(word node) { return Map::left(node); }
+	word right(word node) { return Map::right(node); }
+	bool is_red(word node) { return Map::is_red(node); }
+
+	void set_parent(word node, word link) { Map::set_parent(node, link); }
+	void set_left(word node, word link) { Map::set_left(node, link); }
+	void set_right(word node, word link) { Map::set_right(node, link); }
+	void set_red(word node) { Map::set_red(node); }
+	void set_black(word node) { Map::set_black(node); }
+
+	word tree_root() { return map->root; }
+	void set_root(word node) { map->root = node; }
+
+	int node_compare(word lnode, word rnode) { return Map::node_compare(lnode, rnode); }
+	int key_compare(word lnode, word rkey) { return Map::key_compare(lnode, rkey); }
+
+public:
+	MapTree(Map * map) { this->map = map; }
+
+	void node_print(int indent, word node) { map->node_print(indent, node); }
+};
+
+/*
+  A MapNode which also knows how many nodes are in the subtree below it (itself included).
+ */
+struct CountedMapNode : public MapNode {
+	word count;
+
+	CountedMapNode() : MapNode() { count = 1; }
+	CountedMapNode(word key) : MapNode(key) { count = 1; }
+};
+
+/*
+  CountedMap is a Map that keeps subtree counts in its nodes, which answers 'how many keys are
+  below this one' and 'which is the k'th key' in log(n) time rather than by counting along.
+  Percentiles of a sample map are then just select(count() * 95 / 100).
+
+  The counts cost two bytes a node and a walk to the root on every insert and remove (on top of
+  the one the balancing already does), so use a plain Map unless you need them.
+
+  Every node must be a CountedMapNode. Use a pool of sizeof(CountedMapNode), or add() your own.
+ */
+class CountedMap: public MapCore<CountedMap> {
+	friend class RedBlackCore<CountedMap>;
+private:
+	static const bool augmented = true;
+
+	static word count_of(word node) { return (node==0) ? 0 : ((CountedMapNode *)node)->count; }
+
+	static void augment(word node) {
+		CountedMapNode * n = (CountedMapNode *)node;
+		n->count = 1 + count_of(n->left) + count_of(n->right);
+	}
+	static void augment_swap(word x, word y) {
+		word c = ((CountedMapNode *)x)->count;
+		((CountedMapNode *)x)->count = ((CountedMapNode *)y)->count;
+		((CountedMapNode *)y)->count = c;
+	}
+
+public:
+	CountedMap() : MapCore<CountedMap>(0) { }
+	CountedMap(MapPool * pool) : MapCore<CountedMap>(pool) { }
+
+	// how many keys in the map
+	word count() { return count_of(root); }
+
+	// how many keys are strictly less than this one
+	word rank(word key) {
+		word r = 0;
+		word n = root;
+		while(n) {
+			if(key_compare(n, key) < 0) {
+				// this node and everything on its left are before the key
+				r += count_of(left(n)) + 1;
+				n = right(n);
+			} else {
+				n = left(n);
+			}
+		}
+		return r;
+	}
+
+	// the k'th node in key order (counting from zero), or null if there aren't that many
+	CountedMapNode * select(word k) {
+		word n = root;
+		while(n) {
+			word l = count_of(left(n));
+			if(k < l) {
+				n = left(n);
+			} else if(k == l) {
+				return (CountedMapNode *)n;
+			} else {
+				k -= l + 1;
+				n = right(n);
+			}
+		}
+		return 0;
+	}
+
+	// how many keys fall in lo..hi (inclusive)
+	word count_range(word lo, word hi) {
+		// keys only go up to 0x7FFF, and rank() can't be asked about anything past that
+		if(hi < lo || lo > 0x7FFF) return 0;
+		if(hi >= 0x7FFF) return count() - rank(lo);
+		return rank(hi + 1) - rank(lo);
+	}
+};
+
+
+/*
+  CompactMap is a Map whose nodes live in a fixed array and link to each other by array index
+  rather than by pointer. The Index type sets the link width - with 'byte' links a node costs
+  five bytes (three links and the key word) instead of the eight a MapNode takes, and the
+  whole table sits in one contiguous block.
+
+  Memory, per node:
+    MapNode, new'd from the heap       8 + 2 (malloc header) = 10 bytes
+    MapNode, from a MapPool            8 bytes
+    CompactMapNode<word>               8 bytes
+    CompactMapNode<byte>               5 bytes
+  So the 128-signal and 64-code tables cost 640 + 320 bytes as byte-indexed maps, against
+  1280 + 640 bytes of heap nodes.
+
+  Speed is much the same as Map. The tree algorithms are exactly the same code (they already
+  work in terms of NodeView words, and here those words are simply indexes) and every link
+  access is an index multiply-add into the array instead of a direct pointer load, which the
+  32U4's hardware multiplier makes cheap. On the desktop (tools/compactmap-bench.cpp, 64 to
+  255 keys) inserts and erases come out within 10% of heap Map either way, and seeks - where
+  the extra address arithmetic isn't hidden behind any allocation - run at 80 to 95% of Map.
+
+  Index zero is the null link, so node indexes run from 1 to capacity, and capacity can be at
+  most 255 for byte links (the constructor clamps it). The colour bit stays in the top of the key word just like MapNode,
+  so that byte links can still address a full 255 nodes.
+
+  Payload is best kept in your own arrays, indexed by node index:
+
+    CompactMap<byte> signals(128);
+    int signal_value[129];
+    byte n = signals.insert(42);
+    if(n) signal_value[n] = 1000;
+ */
+template <class Index> struct CompactMapNode {
+	Index parent;
+	Index left;
+	Index right;
+	word meta; // color bit plus key
+};
+
+template <class Index> class CompactMap: public RedBlackCore< CompactMap<Index> > {
+	friend class RedBlackCore< CompactMap<Index> >;
+	typedef RedBlackCore< CompactMap<Index> > Tree;
+private:
+	CompactMapNode<Index> * nodes;
+	Index root;
+	Index free_list;
+
+	CompactMapNode<Index> * at(word node) { return &nodes[node-1]; }
+
+	// node accessors for the tree algorithms
+	word parent(word node) { return at(node)->parent; }
+	word left(word node) { return at(node)->left; }
+	word right(word node) { return at(node)->right; }
+	bool is_red(word node) { return (at(node)->meta & 0x8000)!=0; }
+
+	void set_parent(word node, word link) { at(node)->parent = link; }
+	void set_left(word node, word link)  { at(node)->left = link; }
+	void set_right(word node, word link)  { at(node)->right = link; }
+	void set_red(word node)  { at(node)->meta |= 0x8000; }
+	void set_black(word node)  { at(node)->meta &= 0x7FFF; }
+
+	word tree_root() { return root; }
+	void set_root(word node) { root = node; }
+
+	int node_compare(word lnode, word rnode) {   
+		word lkey = at(lnode)->meta & 0x7FFF;
+		word rkey = at(rnode)->meta & 0x7FFF;
+		return lkey - rkey;
+	};
+
+	int key_compare(word lnode, word rkey) {
+		word lkey = at(lnode)->meta & 0x7FFF;
+		return lkey - rkey;
+	};
+
+	void node_print(int indent, word node) {
+		this->indent_print(indent);
+		if(node==0) {
+			Serial.print("[empty]\n");
+		} else {
+			Serial.print("[node "); Serial.print(node);
+			Serial.print(" parent:"); Serial.print(at(node)->parent);
+			Serial.print((at(node)->meta & 0x8000) ? " red" : " black"); 
+			Serial.print("]:"); Serial.print(at(node)->meta & 0x7FFF);
+			Serial.print("\n");
+			node_print(indent+1, at(node)->left );
+			node_print(indent+1, at(node)->right );
+		}
+	}
+
+public:
+	word capacity;
+	word used;
+	word high_water;
+
+	// constructor. count is clamped to what an Index can address - 255 nodes for byte links.
+	CompactMap(word count) {
+		Index most = (Index)~(Index)0;
+		if(count > most) count = most;
+		nodes = new CompactMapNode<Index>[count];
+		capacity = count;
+		clear();
+	}
+	~CompactMap() {
+		delete[] nodes;
+	}
+
+	// empty the map, and return every node to the free list
+	void clear() {
+		root = 0;
+		free_list = 0;
+		// thread the free list through the parent links, lowest index first
+		word i = capacity;
+		while(i > 0) {
+			at(i)->parent = free_list;
+			free_list = i--;
+		}
+		used = 0;
+		high_water = 0;
+	}
+
+	// refill the map from keys in strictly ascending order, in linear time. Nodes are
+	// numbered 1..count in key order. False if they're out of order or won't fit.
+	bool build(const word * keys, word count) {
+		if(count > capacity) return false;
+		for(word i = 1; i < count; i++) {
+			if((keys[i-1] & 0x7FFF) >= (keys[i] & 0x7FFF)) return false;
+		}
+		// clear() threads the free list in index order, so the first 'count' are ours
+		clear();
+		for(word i = 1; i <= count; i++) {
+			at(i)->meta = keys[i-1] & 0x7FFF;
+			at(i)->right = (i < count) ? i+1 : 0;
+		}
+		free_list = (count < capacity) ? count+1 : 0;
+		used = count;
+		high_water = count;
+		this->tree_build((count > 0) ? 1 : 0, count);
+		return true;
+	}
+
+	// return the node index for the key, allocating one if needed. Zero if the table is full.
+	Index insert(word key) {
+		Index n = free_list;
+		if(n==0) {
+			// we can still find existing keys when full
+			return this->tree_seek_node(key & 0x7FFF, Tree::MATCH_EXACT);
+		}
+		CompactMapNode<Index> * node = at(n);
+		free_list = node->parent;
+		node->meta = key & 0x7FFF;
+		word conflict = this->tree_insert_node(n);
+		if(conflict) {
+			// already there. put the spare back.
+			node->parent = free_list;
+			free_list = n;
+			return conflict;
+		}
+		if(++used > high_water) high_water = used;
+		return n;
+	}
+	bool erase(word key) {
+		Index n = this->tree_seek_node(key, Tree::MATCH_EXACT);
+		if(n) {
+			this->tree_remove_node(n);
+			at(n)->parent = free_list;
+			free_list = n;
+			used--;
+			return true;
+		}
+		return false;
+	}
+
+	Index seek(word key, int match) { return this->tree_seek_node(key, match); }
+	Index seek(word key) { return this->tree_seek_node(key, Tree::MATCH_EXACT); }
+
+	Index first() { return (root==0) ? 0 : this->leftmost(root); }
+	Index last() { return (root==0) ? 0 : this->rightmost(root); }
+	Index next(Index node) { return this->tree_next_node(node); }
+	Index prev(Index node) { return this->tree_prev_node(node); }
+
+	word key(Index node) { return at(node)->meta & 0x7FFF; }
+	CompactMapNode<Index> * node(Index n) { return at(n); }
 
 	void print() {
 		node_print(0,root);
@@ -0,0 +1,432 @@
+#include <unorthodox.h>
+
+/*
+  Cursor conformance and speed check.
+
+  Every cursor type is fed a fixed table of inputs with known answers, and then a few thousand
+  randomly generated ones, which are checked against the values they were generated from. The
+  time taken by every apply() is measured with Timer1 running at the CPU clock, so we get both
+  the overall bytes per second and the worst single byte, in cycles. (Interrupts are held off
+  for each measurement, so the worst case is the cursor's own and not the USB stack's.)
+
+  Run it before and after touching a cursor's apply(), and compare.
+ */
+
+// a small prefix tree: "led" = 0, "ledon" = 1, "list" = 2
+prog_uchar names[] PROGMEM = {
+  3,
+  0x0D, 'l', 2, 'e', 'i', 13, 0, 23, 0,  // span "l", then 'e' or 'i'
+  0x0F, 'd', 0, 1, 'o', 20, 0,           // span "d", symbol 0, then 'o'
+  0x0E, 'n', 1,                          // span "n", symbol 1
+  0x16, 's', 't', 2                      // span "st", symbol 2
+};
+const char * name_text[] = { "led", "ledon", "list" };
+
+prog_uchar literal[] PROGMEM = "T:23 H:45";
+
+// a DFA for "on" = 1, "off" = 2 and numbers = 3, from tools/dfa-compile
+/*
+  generated by dfa-compile: 7 states, 5 byte classes, 302 bytes
+
+    1 on
+    2 off
+    3 [0-9]+
+ */
+PROGMEM prog_uchar cmd_dfa[] = {
+  7,5,1,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,1,1,1,1,1,1,1,1,1,1,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,2,0,0,0,0,0,
+  0,0,3,4,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,3,0,0,1,2,0,0,0,0,0,
+  0,2,0,0,3,0,2,0,0,0,0,0,4,5,0,0,
+  0,6,0,0,0,0,0,0,0,0,0,0,0,0,
+};
+
+// the parts of a "T:23 H:45 V:-12,33,40" telemetry record
+prog_uchar t_text[] PROGMEM = "T:";
+prog_uchar h_text[] PROGMEM = " H:";
+prog_uchar v_text[] PROGMEM = " V:";
+
+BufferCursor buffer_cursor(8);
+NearProgramPage literal_page(literal);
+PageCursor page_cursor(&literal_page, 9);
+NumberCursor number_cursor;
+NumberCursor signed_cursor(NumberCursor::SIGNED);
+LongNumberCursor long_cursor(LongNumberCursor::SIGNED);
+LongNumberCursor hex_cursor(LongNumberCursor::SIGNED | LongNumberCursor::HEX_PREFIX);
+LongNumberCursor fixed_cursor(LongNumberCursor::SIGNED | LongNumberCursor::FIXED_POINT, 3);
+PrefixCursor prefix_cursor(names);
+DFACursor dfa_cursor(cmd_dfa);
+
+// alternation: the names, or the DFA (set up in build_combinators)
+CursorSet set_cursor;
+
+// the combinators
+struct Telemetry { int t; int h; int v[3]; } rec;
+NearProgramPage t_page(t_text), h_page(h_text), v_page(v_text);
+PageCursor t_tag(&t_page, 2), h_tag(&h_page, 3), v_tag(&v_page, 3);
+NumberCursor t_num, h_num;
+NumberCursor v_num(NumberCursor::SIGNED);
+CaptureCursor t_cap(&t_num, &rec.t), h_cap(&h_num, &rec.h);
+RepeatCursor v_list(&v_num, ',', 1, 3, rec.v);
+SequenceCursor record_cursor;
+NumberCursor list_num;
+RepeatCursor list_cursor(&list_num, ',', 1, 3);
+NumberCursor optional_num;
+OptionalCursor optional_cursor(&optional_num);
+
+// a small ring, so frames wrap around it
+byte ring_storage[16];
+ByteRing ring(ring_storage, 16);
+RingCursor ring_cursor(&ring, '\n');
+NumberCursor frame_number;
+
+// conformance table
+struct Expect {
+  Cursor * cursor;
+  const char * input;
+  bool accept;
+  int symbol;
+};
+
+Expect expect[] = {
+  { &buffer_cursor, "12345678", true, 1 },
+  { &buffer_cursor, "1234567", false, 0 },
+  { &buffer_cursor, "123456789", false, 0 },
+  { &page_cursor, "T:23 H:45", true, 1 },
+  { &page_cursor, "T:23 H:4", false, 0 },
+  { &page_cursor, "T:23 H:456", false, 0 },
+  { &page_cursor, "T:24 H:45", false, 0 },
+  { &number_cursor, "0", true, 0 },
+  { &number_cursor, "12345", true, 12345 },
+  { &number_cursor, "-1", false, 0 },
+  { &number_cursor, "", false, 0 },
+  { &number_cursor, "12a", false, 0 },
+  { &signed_cursor, "-123", true, -123 },
+  { &signed_cursor, "+77", true, 77 },
+  { &signed_cursor, "-", false, 0 },
+  { &long_cursor, "-100000", true, (int)-100000L },
+  { &long_cursor, "+2000000000", true, (int)2000000000L },
+  { &long_cursor, "1-", false, 0 },
+  { &prefix_cursor, "led", true, 0 },
+  { &prefix_cursor, "ledon", true, 1 },
+  { &prefix_cursor, "list", true, 2 },
+  { &prefix_cursor, "le", false, 0 },
+  { &prefix_cursor, "ledo", false, 0 },
+  { &prefix_cursor, "lists", false, 0 },
+  { &prefix_cursor, "x", false, 0 },
+  { &dfa_cursor, "on", true, 1 },
+  { &dfa_cursor, "off", true, 2 },
+  { &dfa_cursor, "0042", true, 3 },
+  { &dfa_cursor, "o", false, 0 },
+  { &dfa_cursor, "onx", false, 0 },
+  { &dfa_cursor, "", false, 0 },
+  { &set_cursor, "ledon", true, 1 },
+  { &set_cursor, "off", true, 2 },
+  { &set_cursor, "12", true, 3 },
+  { &set_cursor, "lex", false, 0 },
+  { &record_cursor, "T:23 H:45 V:-12,33,40", true, 1 },
+  { &record_cursor, "T:23 H:45 V:7", true, 1 },
+  { &record_cursor, "T:23 H:45 V:", false, 0 },
+  { &record_cursor, "T:23 H:45 V:1,2,3,4", false, 0 },
+  { &record_cursor, "T:23 V:1", false, 0 },
+  { &list_cursor, "1,2,3", true, 3 },
+  { &list_cursor, "5", true, 1 },
+  { &list_cursor, "", false, 0 },
+  { &list_cursor, "1,", false, 0 },
+  { &list_cursor, "1,,2", false, 0 },
+  { &list_cursor, "1,2,3,4", false, 0 },
+  { &optional_cursor, "", true, 0 },
+  { &optional_cursor, "12", true, 12 },
+  { &optional_cursor, "x", false, 0 },
+  { &t_cap, "77", true, 77 },
+  { 0, 0, false, 0 }
+};
+
+// LongNumberCursor answers don't fit in a symbol(), so they get a table of their own
+struct LongExpect {
+  LongNumberCursor * cursor;
+  const char * input;
+  bool accept;
+  long value;
+  bool overflow;
+};
+
+const long LONG_TOP = 2147483647L;
+const long LONG_BOTTOM = -2147483647L - 1;
+
+LongExpect long_expect[] = {
+  { &long_cursor, "2147483647", true, LONG_TOP, false },
+  { &long_cursor, "2147483648", true, LONG_TOP, true },
+  { &long_cursor, "-2147483648", true, LONG_BOTTOM, false },
+  { &long_cursor, "-2147483649", true, LONG_BOTTOM, true },
+  { &long_cursor, "99999999999999", true, LONG_TOP, true },
+  { &long_cursor, "0x10", false, 0, false },
+  { &long_cursor, "1.5", false, 0, false },
+  { &hex_cursor, "0x1F", true, 31, false },
+  { &hex_cursor, "0XffFF", true, 65535, false },
+  { &hex_cursor, "-0x10", true, -16, false },
+  { &hex_cursor, "0", true, 0, false },
+  { &hex_cursor, "017", true, 17, false },
+  { &hex_cursor, "0x7FFFFFFF", true, LONG_TOP, false },
+  { &hex_cursor, "0xFFFFFFFF", true, -1, false },
+  { &hex_cursor, "0x100000000", true, LONG_TOP, true },
+  { &hex_cursor, "-0x123456789", true, LONG_BOTTOM, true },
+  { &hex_cursor, "0x", false, 0, false },
+  { &hex_cursor, "0x1G", false, 0, false },
+  { &hex_cursor, "x1", false, 0, false },
+  { &fixed_cursor, "12.5", true, 12500, false },
+  { &fixed_cursor, "-0.001", true, -1, false },
+  { &fixed_cursor, "3", true, 3000, false },
+  { &fixed_cursor, "1.23456", true, 1234, false },
+  { &fixed_cursor, "2147483.647", true, LONG_TOP, false },
+  { &fixed_cursor, "2147484", true, LONG_TOP, true },
+  { &fixed_cursor, "-2147483.648", true, LONG_BOTTOM, false },
+  { &fixed_cursor, "-2147483.649", true, LONG_BOTTOM, true },
+  { &fixed_cursor, "12.", false, 0, false },
+  { &fixed_cursor, ".5", false, 0, false },
+  { &fixed_cursor, "1.2.3", false, 0, false },
+  { 0, 0, false, 0, false }
+};
+
+// timing
+word overhead = 0;
+unsigned long total_bytes;
+unsigned long total_cycles;
+word worst_cycles;
+int failures = 0;
+
+void timer_start() {
+  // Timer1 free-running at the cpu clock
+  TCCR1A = 0;
+  TCCR1B = 1;
+  // how long does it take just to read the timer twice?
+  noInterrupts();
+  word t0 = TCNT1;
+  word t1 = TCNT1;
+  interrupts();
+  overhead = t1 - t0;
+}
+
+void bench_reset() {
+  total_bytes = 0;
+  total_cycles = 0;
+  worst_cycles = 0;
+}
+
+bool timed_apply(Cursor * c, byte b) {
+  noInterrupts();
+  word t0 = TCNT1;
+  bool r = c->apply(b);
+  word t1 = TCNT1;
+  interrupts();
+  word t = t1 - t0;
+  // (never wrap below zero, should the timer read faster than it did in timer_start)
+  t = (t > overhead) ? t - overhead : 0;
+  total_bytes++;
+  total_cycles += t;
+  if(t > worst_cycles) worst_cycles = t;
+  return r;
+}
+
+// feed a whole string, and report the final state
+bool feed(Cursor * c, const char * s) {
+  c->reset();
+  while(*s) timed_apply(c, *s++);
+  return c->accept();
+}
+
+void fail(const char * what, const char * input) {
+  failures++;
+  Serial.print("\n FAIL "); Serial.print(what); Serial.print(" \""); Serial.print(input); Serial.print('"');
+}
+
+void report(const char * name) {
+  Serial.print("\n "); Serial.print(name);
+  Serial.print(" bytes:"); Serial.print(total_bytes);
+  if(total_cycles) {
+    Serial.print(" bytes/sec:"); Serial.print((unsigned long)((float)total_bytes * F_CPU / total_cycles));
+  }
+  Serial.print(" worst cycles/byte:"); Serial.print(worst_cycles);
+}
+
+void check_table() {
+  Serial.print("\n conformance...");
+  for(Expect * e = expect; e->cursor; e++) {
+    bool a = feed(e->cursor, e->input);
+    if(a != e->accept) fail("accept", e->input);
+    else if(a && (e->cursor->symbol() != e->symbol)) fail("symbol", e->input);
+  }
+  for(LongExpect * e = long_expect; e->cursor; e++) {
+    bool a = feed(e->cursor, e->input);
+    if(a != e->accept) fail("accept", e->input);
+    else if(a && (e->cursor->value() != e->value)) fail("value", e->input);
+    else if(a && (e->cursor->overflow() != e->overflow)) fail("overflow", e->input);
+  }
+}
+
+void build_combinators() {
+  set_cursor.add(&prefix_cursor);
+  set_cursor.add(&dfa_cursor);
+  record_cursor.add(&t_tag); record_cursor.add(&t_cap);
+  record_cursor.add(&h_tag); record_cursor.add(&h_cap);
+  record_cursor.add(&v_tag); record_cursor.add(&v_list);
+}
+
+// what the combinators leave behind, beyond accept and symbol
+void check_combinators() {
+  const char * line = "T:23 H:45 V:-12,33,40";
+  memset(&rec, 0, sizeof(rec));
+  feed(&record_cursor, line);
+  if(rec.t != 23 || rec.h != 45 || rec.v[0] != -12 || rec.v[1] != 33 || rec.v[2] != 40) fail("captured fields", line);
+  // "led" accepted on the way to "ledon", and the DFA died on the 'l'
+  feed(&set_cursor, "ledo");
+  if(set_cursor.accept() || set_cursor.longest_index() != 0 || set_cursor.longest_length() != 3 || set_cursor.longest_symbol() != 0) fail("longest match", "ledo");
+  if(set_cursor.live_mask() != 1) fail("live mask", "ledo");
+}
+
+// RingCursor frames live in the ring rather than the cursor, so it gets a check of its own
+void check_ring() {
+  char text[8];
+  for(int i=0; i<40; i++) {
+    itoa(i * 37, text, 10);
+    byte length = strlen(text);
+    for(byte j=0; j<length; j++) ring_cursor.apply(text[j]);
+    if(ring_cursor.accept()) fail("ring frame too soon", text);
+    ring_cursor.apply('\n');
+    bool same = ring_cursor.frame()->length == length;
+    for(byte j=0; same && j<length; j++) same = ring_cursor.frame()->read_byte(j) == text[j];
+    if(!ring_cursor.accept() || ring_cursor.symbol() != length) fail("ring frame", text);
+    else if(!same) fail("ring page", text);
+    else if(!ring_cursor.feed(&frame_number) || frame_number.symbol() != i * 37) fail("ring feed", text);
+    ring_cursor.release();
+    if(!ring.empty()) fail("ring release", text);
+  }
+  // an unterminated frame that fills the ring is thrown away, and receiving carries on
+  word overruns = ring_cursor.overruns;
+  for(int i=0; i<20; i++) ring_cursor.apply('1');
+  ring_cursor.apply('\n');
+  if(ring_cursor.overruns != overruns + 1) fail("ring overrun", "1111...");
+  else if(!ring_cursor.feed(&frame_number) || frame_number.symbol() != 11111) fail("ring after overrun", "11111");
+  ring_cursor.release();
+}
+
+const int runs = 2000;
+
+void bench_numbers() {
+  char text[16];
+  bench_reset();
+  for(int i=0; i<runs; i++) {
+    int v = random(-32767, 32767);
+    itoa(v, text, 10);
+    if(!feed(&signed_cursor, text) || signed_cursor.symbol() != v) fail("number", text);
+    // a trailing space must be rejected
+    if(timed_apply(&signed_cursor, ' ')) fail("number reject", text);
+  }
+  report("NumberCursor");
+  bench_reset();
+  for(int i=0; i<runs; i++) {
+    // random(lo, hi) works out hi - lo as a long, so build big values from two calls
+    long v = random(-20000, 20000) * 100000L + random(100000);
+    ltoa(v, text, 10);
+    if(!feed(&long_cursor, text) || long_cursor.value() != v) fail("long", text);
+  }
+  report("LongNumberCursor");
+  bench_reset();
+  for(int i=0; i<runs; i++) {
+    // any 32-bit pattern, which reads back as a long of the same bits
+    unsigned long v = ((unsigned long)random(0x10000) << 16) | random(0x10000);
+    strcpy(text, "0x");
+    ultoa(v, text + 2, 16);
+    if(!feed(&hex_cursor, text) || hex_cursor.value() != (long)(int32_t)v) fail("hex", text);
+  }
+  report("LongNumberCursor hex");
+  bench_reset();
+  for(int i=0; i<runs; i++) {
+    // three decimal places, for a scale of 3
+    long v = random(-20000, 20000) * 100000L + random(100000);
+    unsigned long m = (v < 0) ? -v : v;
+    char * t = text;
+    if(v < 0) *t++ = '-';
+    ultoa(m / 1000, t, 10);
+    t += strlen(t);
+    *t++ = '.';
+    *t++ = '0' + (m / 100) % 10;
+    *t++ = '0' + (m / 10) % 10;
+    *t++ = '0' + m % 10;
+    *t = 0;
+    if(!feed(&fixed_cursor, text) || fixed_cursor.value() != v) fail("fixed point", text);
+  }
+  report("LongNumberCursor fixed");
+}
+
+void bench_prefix() {
+  char text[8];
+  bench_reset();
+  for(int i=0; i<runs; i++) {
+    int n = random(3);
+    strcpy(text, name_text[n]);
+    bool good = random(4) != 0;
+    // spoil one byte in a quarter of them
+    if(!good) text[random(strlen(text))] = 'z';
+    bool a = feed(&prefix_cursor, text);
+    if(a != good || (good && prefix_cursor.symbol() != n)) fail("prefix", text);
+  }
+  report("PrefixCursor");
+}
+
+void bench_page() {
+  char text[12];
+  bench_reset();
+  for(int i=0; i<runs; i++) {
+    strcpy(text, "T:23 H:45");
+    bool good = random(4) != 0;
+    if(!good) text[random(9)] = '#';
+    if(feed(&page_cursor, text) != good) fail("page", text);
+  }
+  report("PageCursor");
+}
+
+void bench_buffer() {
+  char text[10];
+  bench_reset();
+  for(int i=0; i<runs; i++) {
+    for(int j=0; j<8; j++) text[j] = random(1, 256);
+    text[8] = 0;
+    if(!feed(&buffer_cursor, text)) fail("buffer", "(random)");
+    if(timed_apply(&buffer_cursor, 'x')) fail("buffer overrun", "(random)");
+  }
+  report("BufferCursor");
+}
+
+void setup() {
+  Serial.begin(9600);
+  // leonardo - wait for connection
+  while(!Serial) { }
+  timer_start();
+  build_combinators();
+  check_table();
+  check_combinators();
+  check_ring();
+  bench_buffer();
+  bench_page();
+  bench_numbers();
+  bench_prefix();
+  Serial.print("\n failures:"); Serial.print(failures);
+  Serial.print(failures ? " FAILED\n" : " PASSED\n");
+}
+
+void loop() {
+}
@@ -403,6 +403,36 @@ public:
 EEPROMPage eeprom(0);
 LocalDroid droid(&eeprom, 1024, &screen);
 
+#ifdef hal_ranger
+// read the last range (if it finished) and start the next one. runs every 100ms.
+void ranger_update(int dt) {
+  // has the last one finished?
+  if(ranger_state==2) {
+    // compute the elapsed time
+    unsigned long range = (ranger_time[1] - ranger_time[0]);
+    // sanity check
+    if((range>500) && (range < 80000)) {
+      // subtract 500us to account for sensor delays
+      range -= 500;
+      // convert to (approximate) millimeters
+      range = (range<<4)/93;
+      // limit to 5 meters
+      range = min(range, 5000);
+      droid.set_signal(120, range);
+    }
+  }
+  // start the next ranging pulse.
+  ranger_pulse();
+}
+FunctionTask ranger_task(ranger_update);
+#endif
+
+// the droid's own signal and timer processing, as often as the loop comes around
+DroidTask droid_task(&droid);
+
+// timed work
+Scheduler tasks(4);
+
 void setup() {  
   pinMode(A3, INPUT_PULLUP); // joystick button pullup A3
   pinMode(0, INPUT_PULLUP); // infrared RX + pullup
@@ -466,6 +496,8 @@ void setup() {
   EICRA |= (1<<ISC31) | (0<<ISC30);             // trigger on falling edge
   EIMSK |= (1<<INT3);                           // enable external interrupt mask
   EIFR  |= (1<<INTF3);                          // clear the interrupt flag
+  // range every 100ms
+  tasks.every(&ranger_task, 100);
 #endif
 #ifdef hal_beeps
   // initialize timer3
@@ -483,6 +515,8 @@ void setup() {
   //TIMSK4 = (0<<OCIE4A) | (0<<OCIE4B) | (0<<OCIE4D) (0<<TOIE4);   // no enabled masked interrupts
   OCR4C = 0xFF;
 #endif
+  // droid processing on every pass
+  tasks.every(&droid_task, 1);
   // complete
   sei();             // enable all interrupts
   motor_speed(0,0);
@@ -490,7 +524,6 @@ void setup() {
 }
 
 unsigned long last_time = 0;
-unsigned long last_pulse = 0;
 
 void loop() {
   unsigned long time = millis();
@@ -498,8 +531,8 @@ void loop() {
   unsigned long elapsed = ( time < last_time ) ? ( 0xffffffff - last_time + time ) : ( time - last_time );
   // downconvert that to a plain old integer, max out at 32k.
   int dt = (elapsed & 0xffff8000) ? 0x7fff : elapsed;
-  // droid update
-  droid.exec(dt);
+  // run the droid and whatever timed work is due
+  tasks.run();
 #ifdef hal_ir
   ir_update();
 #endif
@@ -528,29 +561,6 @@ void loop() {
   // and update the droid signals
   for(byte i=0; i<3; i++) droid.set_signal(124+i, v[i]);
 #endif
-#ifdef hal_ranger
-  if(last_pulse + 100 < time) {
-    // has the last one finished?
-    if(ranger_state==2) {
-      // compute the elapsed time
-      unsigned long range = (ranger_time[1] - ranger_time[0]);
-      // sanity check
-      if((range>500) && (range < 80000)) {
-        // subtract 500us to account for sensor delays
-        range -= 500;
-        // convert to (approximate) millimeters
-        range = (range<<4)/93;
-        // limit to 5 meters
-        range = min(range, 5000);
-        droid.set_signal(120, range);
-      }
-    }
-    // start the next ranging pulse.
-    ranger_pulse();
-    // record the last time we did this.
-    last_pulse = time;
-  }
-#endif
 #ifdef hal_ir2
   // consume time events from the ir ring
   byte tail = (ir_ring_tail+1) & ir_ring_mask;
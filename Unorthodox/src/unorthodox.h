@@ -11,11 +11,13 @@
 #include <Arduino.h>
 #include <unorthodox_page.h>
 #include <unorthodox_queues.h>
+#include <unorthodox_tasks.h>
 #include <unorthodox_trees.h>
 #include <unorthodox_device.h>
 #include <unorthodox_drivers.h>
 #include <unorthodox_drivers_i2c.h>
 #include <unorthodox_drivers_spi.h>
+#include <unorthodox_net.h>
 #include <unorthodox_cursor.h>
 #include <unorthodox_raster.h>
 #include <unorthodox_droid.h>
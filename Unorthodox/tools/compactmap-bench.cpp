@@ -0,0 +1,114 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  compactmap-bench : host-side timing of CompactMap against Map, over the same shuffled keys.
+  Map is timed both with heap nodes and with a MapPool, and CompactMap with word and byte
+  links. Table sizes stay within the 255 nodes byte links can address.
+
+  Build and run it on the desktop, not the Arduino:
+
+    g++ -O2 -DHOST_WIDE_WORD -I host -I ../arch/avr -o compactmap-bench compactmap-bench.cpp
+    ./compactmap-bench
+
+  HOST_WIDE_WORD is needed because Map links are pointers held in words. It also makes every
+  link eight bytes here, so the node sizes printed are the host's - on the Leonardo they are
+  10 (heap MapNode), 8 (pooled MapNode or CompactMapNode<word>) and 5 (CompactMapNode<byte>).
+
+  What the figures compare is the relative cost of index links over pointer links, not how
+  fast anything runs on the 32U4.
+ */
+
+#include <Arduino.h>
+#include <bench.h>
+#include <unorthodox_page.h>
+#include <unorthodox_trees.h>
+
+Stream Serial;
+uint8_t SREG;
+
+static void report(const char * name, int count, long ops, Timing & t, Timing & base) {
+	printf("  %-22s insert %6.1f  seek %6.1f  erase %6.1f  M/s   (%3.0f%% %3.0f%% %3.0f%% of heap Map)\n",
+		name, ops / t.insert / 1e6, ops / t.seek / 1e6, ops / t.remove / 1e6,
+		100 * base.insert / t.insert, 100 * base.seek / t.seek, 100 * base.remove / t.remove);
+}
+
+template <class Index> static void time_compact(word * keys, int count, int reps, Timing & t) {
+	for(int r = 0; r < reps; r++) {
+		CompactMap<Index> map(count);
+		double a = now();
+		for(int i = 0; i < count; i++) sink = map.insert(keys[i]);
+		double b = now();
+		for(int i = 0; i < count; i++) sink = map.seek(keys[(i * 7) % count]);
+		double c = now();
+		for(int i = 0; i < count; i++) sink = map.erase(keys[(i * 13) % count]);
+		double d = now();
+		t.add(a, b, c, d);
+	}
+}
+
+static void time_pooled(word * keys, int count, int reps, Timing & t) {
+	for(int r = 0; r < reps; r++) {
+		MapPool pool(sizeof(MapNode), count);
+		Map map(&pool);
+		double a = now();
+		for(int i = 0; i < count; i++) sink = (word)map.insert(keys[i]);
+		double b = now();
+		for(int i = 0; i < count; i++) sink = (word)map.seek(keys[(i * 7) % count]);
+		double c = now();
+		for(int i = 0; i < count; i++) sink = map.erase(keys[(i * 13) % count]);
+		double d = now();
+		t.add(a, b, c, d);
+	}
+}
+
+static void time_heap(word * keys, int count, int reps, Timing & t) {
+	for(int r = 0; r < reps; r++) {
+		Map map;
+		double a = now();
+		for(int i = 0; i < count; i++) {
+			MapNode * node = new MapNode();
+			node->set_key(keys[i]);
+			sink = map.add(node);
+		}
+		double b = now();
+		for(int i = 0; i < count; i++) sink = (word)map.seek(keys[(i * 7) % count]);
+		double c = now();
+		for(int i = 0; i < count; i++) sink = map.rm(keys[(i * 13) % count]);
+		double d = now();
+		t.add(a, b, c, d);
+	}
+}
+
+static void bench(int count) {
+	// distinct keys in random order
+	word keys[32768];
+	shuffle_keys(keys, 32768);
+	int reps = 1000000 / count;
+	long ops = (long)count * reps;
+
+	// interleave the rounds, so any slow patch on the host hits every map alike
+	Timing heap, pooled, wide, narrow;
+	for(int round = 0; round < BENCH_ROUNDS; round++) {
+		Timing t1, t2, t3, t4;
+		time_heap(keys, count, reps, t1); heap.best(t1);
+		time_pooled(keys, count, reps, t2); pooled.best(t2);
+		time_compact<word>(keys, count, reps, t3); wide.best(t3);
+		time_compact<byte>(keys, count, reps, t4); narrow.best(t4);
+	}
+
+	printf("%d keys:\n", count);
+	report("Map, heap nodes", count, ops, heap, heap);
+	report("Map, MapPool", count, ops, pooled, heap);
+	report("CompactMap<word>", count, ops, wide, heap);
+	report("CompactMap<byte>", count, ops, narrow, heap);
+}
+
+int main() {
+	srand(1);
+	printf("host node sizes: MapNode %d, CompactMapNode<word> %d, CompactMapNode<byte> %d\n",
+		(int)sizeof(MapNode), (int)sizeof(CompactMapNode<word>), (int)sizeof(CompactMapNode<byte>));
+	bench(64);
+	bench(128);
+	bench(255);
+	return 0;
+}
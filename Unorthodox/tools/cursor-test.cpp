@@ -0,0 +1,50 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  cursor-test : the examples/cursor-bench sketch, built and run on the desktop. Every cursor
+  gets the same conformance table and random inputs as on the Leonardo, and the exit status is
+  the number of failures, so it can be run after every change to a cursor.
+
+    g++ -O2 -DHOST_WIDE_WORD -I host -I ../arch/avr -I ../src -o cursor-test cursor-test.cpp
+    ./cursor-test
+
+  (HOST_WIDE_WORD because unorthodox_trees.h, which PrefixCursor needs, keeps Map pointers in
+  words, and won't compile with 16-bit ones on the desktop. Nothing here uses a Map.)
+
+  Timer1 is stood in for by a host counter, so the worst "cycles" per byte are host ticks, and
+  bytes/sec is worked out as if those ticks came at F_CPU. They're good for comparing one build
+  of a cursor with another on the same machine, and nothing else.
+ */
+
+#include <time.h>
+#include <Arduino.h>
+#include <unorthodox_page.h>
+#include <unorthodox_queues.h>
+#include <unorthodox_trees.h>
+#include <unorthodox_cursor.h>
+
+Stream Serial;
+uint8_t SREG;
+
+// Timer1. On x86 the time stamp counter stands in, which ticks fast enough to time a single
+// apply(). Elsewhere it's the host clock in F_CPU units, which mostly can't.
+static byte TCCR1A, TCCR1B;
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static word host_timer1() { return (word)__rdtsc(); }
+#else
+static word host_timer1() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (word)((t.tv_sec * 1000000000ULL + t.tv_nsec) * (F_CPU / 1000000) / 1000);
+}
+#endif
+#define TCNT1 host_timer1()
+
+// (its own #include <unorthodox.h> finds nothing to add off the AVR)
+#include "../examples/cursor-bench.cpp"
+
+int main() {
+	setup();
+	return failures;
+}
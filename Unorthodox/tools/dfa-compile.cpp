@@ -0,0 +1,446 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  dfa-compile : host-side tool which turns a small set of regular expressions into a minimized
+  DFA table for DFACursor. (see unorthodox_cursor.h for the table layout)
+
+  Build and run it on the desktop, not the Arduino:
+
+    g++ -O2 -o dfa-compile dfa-compile.cpp
+    ./dfa-compile command_dfa commands.txt > command_dfa.h
+
+  The grammar file has one pattern per line, preceded by the symbol (1..255) that DFACursor will
+  return when it matches. Where two patterns match the same input, the earlier line wins.
+  Blank lines and lines starting with '#' are ignored.
+
+    # sensor line parsing
+    1 T[0-9]+
+    2 H[0-9]+(\.[0-9]+)?
+    3 [A-Z][A-Z0-9]*=-?[0-9]+
+
+  Supported syntax: literals, '.', [a-z] classes (with ^ negation), ( ) grouping, | alternation,
+  and the * + ? repeats. Escapes are \n \r \t \xHH \d \w \s and \ before any other character.
+
+  The compiler does the textbook steps: each pattern becomes an NFA (Thompson's construction),
+  those are unioned and turned into a DFA by subset construction, the DFA is minimized by
+  partition refinement, and finally the 256 input bytes are grouped into equivalence classes
+  (bytes which every state treats identically) so the transition table only needs a column per
+  class rather than per byte.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <bitset>
+
+typedef std::bitset<256> ByteSet;
+
+/*
+  NFA construction
+ */
+struct NState {
+	std::vector<int> eps; // epsilon transitions
+	ByteSet on;           // bytes which lead to 'out'
+	int out;
+	int symbol;           // accept symbol, or zero
+	int priority;         // pattern line order, for resolving accept conflicts
+	NState() { out = -1; symbol = 0; priority = 0; }
+};
+
+struct Fragment {
+	int start;
+	int end;
+};
+
+static std::vector<NState> nfa;
+
+static int new_state() {
+	nfa.push_back(NState());
+	return nfa.size() - 1;
+}
+
+static void fail(const char * message, const std::string & pattern) {
+	fprintf(stderr, "dfa-compile: %s in pattern: %s\n", message, pattern.c_str());
+	exit(1);
+}
+
+class Parser {
+private:
+	std::string src;
+	size_t pos;
+
+	bool more() { return pos < src.size(); }
+	int peek() { return more() ? (unsigned char)src[pos] : -1; }
+
+	int hex(int c) {
+		if(c >= '0' && c <= '9') return c - '0';
+		if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+		fail("bad hex escape", src);
+		return 0;
+	}
+
+	// read an escape sequence (after the backslash) into a byte set
+	ByteSet escape() {
+		ByteSet s;
+		if(!more()) fail("trailing backslash", src);
+		int c = (unsigned char)src[pos++];
+		switch(c) {
+			case 'n': s.set('\n'); break;
+			case 'r': s.set('\r'); break;
+			case 't': s.set('\t'); break;
+			case 'd': for(int i='0'; i<='9'; i++) s.set(i); break;
+			case 'w':
+				for(int i='0'; i<='9'; i++) s.set(i);
+				for(int i='a'; i<='z'; i++) s.set(i);
+				for(int i='A'; i<='Z'; i++) s.set(i);
+				s.set('_');
+				break;
+			case 's': s.set(' '); s.set('\t'); s.set('\r'); s.set('\n'); break;
+			case 'x': {
+				if(pos + 2 > src.size()) fail("short hex escape", src);
+				int h = hex(src[pos]) * 16 + hex(src[pos+1]);
+				pos += 2;
+				s.set(h);
+				break;
+			}
+			default: s.set(c);
+		}
+		return s;
+	}
+
+	// a [...] class
+	ByteSet byte_class() {
+		ByteSet s;
+		bool negate = false;
+		if(peek() == '^') { negate = true; pos++; }
+		bool first = true;
+		while(true) {
+			if(!more()) fail("unterminated [class]", src);
+			int c = (unsigned char)src[pos++];
+			if(c == ']' && !first) break;
+			first = false;
+			ByteSet item;
+			int lo = -1;
+			if(c == '\\') {
+				item = escape();
+				if(item.count() == 1) for(int i=0; i<256; i++) if(item[i]) lo = i;
+			} else {
+				lo = c;
+				item.set(c);
+			}
+			// a range?
+			if(lo >= 0 && peek() == '-' && pos + 1 < src.size() && src[pos+1] != ']') {
+				pos++;
+				int hi = (unsigned char)src[pos++];
+				if(hi == '\\') {
+					ByteSet h = escape();
+					if(h.count() != 1) fail("bad range end", src);
+					for(int i=0; i<256; i++) if(h[i]) hi = i;
+				}
+				if(hi < lo) fail("backwards range", src);
+				for(int i=lo; i<=hi; i++) item.set(i);
+			}
+			s |= item;
+		}
+		if(negate) s.flip();
+		return s;
+	}
+
+	Fragment single(const ByteSet & s) {
+		Fragment f;
+		f.start = new_state();
+		f.end = new_state();
+		nfa[f.start].on = s;
+		nfa[f.start].out = f.end;
+		return f;
+	}
+
+	Fragment empty() {
+		Fragment f;
+		f.start = new_state();
+		f.end = f.start;
+		return f;
+	}
+
+	Fragment atom() {
+		int c = peek();
+		pos++;
+		if(c == '(') {
+			Fragment f = alternation();
+			if(peek() != ')') fail("missing )", src);
+			pos++;
+			return f;
+		} else if(c == '[') {
+			return single(byte_class());
+		} else if(c == '.') {
+			ByteSet s; s.set();
+			return single(s);
+		} else if(c == '\\') {
+			return single(escape());
+		} else if(c == '*' || c == '+' || c == '?') {
+			fail("repeat with nothing to repeat", src);
+		}
+		ByteSet s; s.set(c);
+		return single(s);
+	}
+
+	Fragment repeat() {
+		Fragment a = atom();
+		while(peek() == '*' || peek() == '+' || peek() == '?') {
+			int op = src[pos++];
+			Fragment f;
+			f.start = new_state();
+			f.end = new_state();
+			nfa[f.start].eps.push_back(a.start);
+			nfa[a.end].eps.push_back(f.end);
+			if(op != '+') nfa[f.start].eps.push_back(f.end); // may be skipped
+			if(op != '?') nfa[a.end].eps.push_back(a.start); // may repeat
+			a = f;
+		}
+		return a;
+	}
+
+	Fragment concatenation() {
+		Fragment f = empty();
+		while(more() && peek() != '|' && peek() != ')') {
+			Fragment n = repeat();
+			nfa[f.end].eps.push_back(n.start);
+			f.end = n.end;
+		}
+		return f;
+	}
+
+	Fragment alternation() {
+		Fragment a = concatenation();
+		while(peek() == '|') {
+			pos++;
+			Fragment b = concatenation();
+			Fragment f;
+			f.start = new_state();
+			f.end = new_state();
+			nfa[f.start].eps.push_back(a.start);
+			nfa[f.start].eps.push_back(b.start);
+			nfa[a.end].eps.push_back(f.end);
+			nfa[b.end].eps.push_back(f.end);
+			a = f;
+		}
+		return a;
+	}
+
+public:
+	Parser(const std::string & pattern) {
+		src = pattern;
+		pos = 0;
+	}
+
+	Fragment parse() {
+		Fragment f = alternation();
+		if(more()) fail("unbalanced )", src);
+		return f;
+	}
+};
+
+/*
+  Subset construction
+ */
+typedef std::set<int> StateSet;
+
+static void closure(StateSet & s) {
+	std::vector<int> stack(s.begin(), s.end());
+	while(!stack.empty()) {
+		int n = stack.back();
+		stack.pop_back();
+		for(size_t i=0; i<nfa[n].eps.size(); i++) {
+			int e = nfa[n].eps[i];
+			if(s.insert(e).second) stack.push_back(e);
+		}
+	}
+}
+
+int main(int argc, char ** argv) {
+	if(argc < 2) {
+		fprintf(stderr, "usage: dfa-compile <array-name> [grammar-file]\n");
+		return 1;
+	}
+	const char * name = argv[1];
+	FILE * in = stdin;
+	if(argc > 2) {
+		in = fopen(argv[2], "r");
+		if(!in) { fprintf(stderr, "dfa-compile: can't open %s\n", argv[2]); return 1; }
+	}
+
+	// read the grammar and build one NFA with a common start state
+	int start = new_state();
+	std::vector<std::string> lines;
+	char line[1024];
+	int priority = 0;
+	while(fgets(line, sizeof(line), in)) {
+		std::string l(line);
+		while(!l.empty() && (l[l.size()-1] == '\n' || l[l.size()-1] == '\r')) l.erase(l.size()-1);
+		size_t p = l.find_first_not_of(" \t");
+		if(p == std::string::npos || l[p] == '#') continue;
+		char * rest;
+		long symbol = strtol(l.c_str() + p, &rest, 10);
+		if(rest == l.c_str() + p || symbol < 1 || symbol > 255) {
+			fprintf(stderr, "dfa-compile: expected a symbol (1..255) at the start of: %s\n", l.c_str());
+			return 1;
+		}
+		while(*rest == ' ' || *rest == '\t') rest++;
+		std::string pattern(rest);
+		Fragment f = Parser(pattern).parse();
+		nfa[start].eps.push_back(f.start);
+		nfa[f.end].symbol = symbol;
+		nfa[f.end].priority = ++priority;
+		lines.push_back(l.substr(p));
+	}
+	if(lines.empty()) {
+		fprintf(stderr, "dfa-compile: no patterns\n");
+		return 1;
+	}
+
+	// subset construction. DFA state 0 is the empty set - the dead state.
+	std::map<StateSet, int> ids;
+	std::vector<StateSet> sets;
+	std::vector< std::vector<int> > next;
+	sets.push_back(StateSet());
+	ids[StateSet()] = 0;
+	StateSet s0;
+	s0.insert(start);
+	closure(s0);
+	ids[s0] = 1;
+	sets.push_back(s0);
+	for(size_t d=0; d<sets.size(); d++) {
+		std::vector<int> row(256, 0);
+		for(int c=0; c<256; c++) {
+			StateSet t;
+			for(StateSet::iterator i=sets[d].begin(); i!=sets[d].end(); ++i) {
+				if(nfa[*i].out >= 0 && nfa[*i].on[c]) t.insert(nfa[*i].out);
+			}
+			if(t.empty()) continue;
+			closure(t);
+			std::map<StateSet, int>::iterator f = ids.find(t);
+			if(f == ids.end()) {
+				int id = sets.size();
+				ids[t] = id;
+				sets.push_back(t);
+				row[c] = id;
+			} else {
+				row[c] = f->second;
+			}
+		}
+		next.push_back(row);
+	}
+	// accept symbols. the earliest pattern wins.
+	std::vector<int> accept(sets.size(), 0);
+	for(size_t d=0; d<sets.size(); d++) {
+		int best = 0;
+		for(StateSet::iterator i=sets[d].begin(); i!=sets[d].end(); ++i) {
+			if(nfa[*i].symbol && (best == 0 || nfa[*i].priority < best)) {
+				best = nfa[*i].priority;
+				accept[d] = nfa[*i].symbol;
+			}
+		}
+	}
+
+	// minimize, by refining a partition that starts out split only by accept symbol,
+	// until no two states in a block disagree about which block any byte takes them to.
+	size_t n = sets.size();
+	std::vector<int> block(n);
+	for(size_t d=0; d<n; d++) block[d] = accept[d];
+	size_t blocks = 0;
+	while(true) {
+		std::map< std::vector<int>, int > sig;
+		std::vector<int> nb(n);
+		for(size_t d=0; d<n; d++) {
+			std::vector<int> key;
+			key.push_back(block[d]);
+			for(int c=0; c<256; c++) key.push_back(block[next[d][c]]);
+			std::map< std::vector<int>, int >::iterator f = sig.find(key);
+			if(f == sig.end()) {
+				int id = sig.size();
+				sig[key] = id;
+				nb[d] = id;
+			} else {
+				nb[d] = f->second;
+			}
+		}
+		block = nb;
+		if(sig.size() == blocks) break;
+		blocks = sig.size();
+	}
+
+	// number the minimized states: dead first, then breadth first from the start
+	std::vector<int> number(blocks, -1);
+	std::vector<int> rep; // a DFA state for each output state
+	number[block[0]] = 0;
+	rep.push_back(0);
+	if(number[block[1]] < 0) {
+		number[block[1]] = rep.size();
+		rep.push_back(1);
+	}
+	for(size_t q=1; q<rep.size(); q++) {
+		for(int c=0; c<256; c++) {
+			int t = block[next[rep[q]][c]];
+			if(number[t] < 0) {
+				number[t] = rep.size();
+				rep.push_back(next[rep[q]][c]);
+			}
+		}
+	}
+	int states = rep.size();
+	int start_state = number[block[1]];
+	if(states > 255) {
+		fprintf(stderr, "dfa-compile: %d states is more than a byte can index\n", states);
+		return 1;
+	}
+
+	// group the input bytes into equivalence classes
+	std::map< std::vector<int>, int > columns;
+	std::vector<int> byte_class(256);
+	std::vector< std::vector<int> > column_of;
+	for(int c=0; c<256; c++) {
+		std::vector<int> col;
+		for(int q=0; q<states; q++) col.push_back(number[block[next[rep[q]][c]]]);
+		std::map< std::vector<int>, int >::iterator f = columns.find(col);
+		if(f == columns.end()) {
+			int id = columns.size();
+			columns[col] = id;
+			column_of.push_back(col);
+			byte_class[c] = id;
+		} else {
+			byte_class[c] = f->second;
+		}
+	}
+	int classes = columns.size();
+	if(classes > 255) {
+		fprintf(stderr, "dfa-compile: too many byte classes\n");
+		return 1;
+	}
+
+	// emit the table
+	std::vector<int> out;
+	out.push_back(states);
+	out.push_back(classes);
+	out.push_back(start_state);
+	out.push_back(0);
+	for(int c=0; c<256; c++) out.push_back(byte_class[c]);
+	for(int q=0; q<states; q++) out.push_back(accept[rep[q]]);
+	for(int q=0; q<states; q++) {
+		for(int k=0; k<classes; k++) out.push_back(column_of[k][q]);
+	}
+
+	printf("/*\n  generated by dfa-compile: %d states, %d byte classes, %d bytes\n\n", states, classes, (int)out.size());
+	for(size_t i=0; i<lines.size(); i++) printf("    %s\n", lines[i].c_str());
+	printf(" */\nPROGMEM prog_uchar %s[] = {", name);
+	for(size_t i=0; i<out.size(); i++) {
+		if(i % 16 == 0) printf("\n\t");
+		printf("%d,", out[i]);
+	}
+	printf("\n};\n");
+	return 0;
+}
@@ -0,0 +1,226 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  enc28j60-test : host-side check of the ENC28J60 driver, against the emulated chip in
+  host/enc28j60-emu.h.
+
+    - start() leaves the buffers, MAC address, PHY and interrupt enables set up
+    - a batch run in any order gives the same registers as in order, in fewer frames
+    - zero-copy receive reads packets in place, including ones that straddle the end of the
+      ring, and a cursor reading byte by byte never has to move ERDPT
+    - transmit: tx_write, tx_write_at and tx_send put the right frame on the wire, tx_read
+      reads it back, and tx_checksum agrees with a checksum worked out here (or says so, and
+      stops the DMA engine, if it times out)
+    - interrupt driven receive, with the interrupt fired both in the middle of the driver's
+      SPI frames (so it has to be deferred) and between driver calls. Every packet has to come
+      out, once, in order, intact - while the main loop is switching banks under it, which the
+      interrupt has to put back.
+
+    g++ -O2 -I host -I ../arch/avr -o enc28j60-test enc28j60-test.cpp
+    ./enc28j60-test [seed]
+ */
+
+#include <vector>
+#include <Arduino.h>
+#include <SPI.h>
+#include <unorthodox_page.h>
+#include <unorthodox_queues.h>
+#include <unorthodox_device.h>
+#include <unorthodox_drivers_spi.h>
+#include <enc28j60-emu.h>
+
+Stream Serial;
+uint8_t SREG;
+volatile uint8_t SPCR, SPDR, SPSR;
+volatile uint8_t fake_ports[HOST_PORTS];
+SPIClass SPI;
+
+static const int PIN = 10;
+static ENC28J60Emulator chip(PIN);
+static ENC28J60 eth(PIN);
+static int failures = 0;
+
+static void check(bool ok, const char * what) {
+	if(!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+// a test packet: a sequence number, then bytes that follow from it
+static word make_packet(byte * f, int seq) {
+	word length = 60 + (seq * 37) % 900;
+	f[0] = seq >> 8;
+	f[1] = seq;
+	for(int i=2; i<length; i++) f[i] = (byte)(seq + i);
+	return length;
+}
+
+static void test_start() {
+	long frames = chip.frames;
+	eth.start();
+	printf("start: %ld frames\n", chip.frames - frames);
+	check(eth.device_revision == 6, "revision read back");
+	check(chip.reg_word(0, 0x08) == ENC28J60::RXSTART_INIT, "ERXST");
+	check(chip.reg_word(0, 0x0A) == ENC28J60::RXSTOP_INIT, "ERXND");
+	check(chip.reg_word(0, 0x04) == ENC28J60::TXSTART_INIT, "ETXST");
+	check(chip.reg_word(0, 0x0C) == ENC28J60::RXSTART_INIT, "ERXRDPT");
+	// MAADR1-6 are at 4,5,2,3,0,1 in bank 3
+	static const byte maadr[6] = { 4, 5, 2, 3, 0, 1 };
+	for(int i=0; i<6; i++) check(chip.bank[3][maadr[i]] == eth.mac_address[i], "MAC address");
+	check(chip.bank[2][0x00] == (ENC28J60::MACON1_MARXEN | ENC28J60::MACON1_TXPAUS | ENC28J60::MACON1_RXPAUS), "MACON1");
+	check(chip.phy[ENC28J60::PHCON2] == ENC28J60::PHCON2_HDLDIS, "PHCON2 through the MII");
+	check(chip.bank[0][0x1B] == (ENC28J60::EIE_INTIE | ENC28J60::EIE_PKTIE), "EIE");
+	check(chip.bank[0][0x1F] & ENC28J60::ECON1_RXEN, "receive enabled");
+}
+
+static void test_batch() {
+	// the same writes, spread over all four banks, run both ways
+	static const byte regs[8] = { ENC28J60::EDMAST, ENC28J60::MAIPG, ENC28J60::EPMM0, ENC28J60::MAADR3,
+	                              ENC28J60::EDMAND, ENC28J60::MABBIPG, ENC28J60::EPMCS, ENC28J60::MAADR4 };
+	long frames[2];
+	for(int any=0; any<2; any++) {
+		eth.read_reg_byte(ENC28J60::EREVID); // start from bank 3 both times
+		ENC28J60Op ops[8];
+		ENC28J60Batch batch(ops, 8);
+		for(int i=0; i<8; i++) batch.write(regs[i], 0x10 * any + i);
+		long f = chip.frames;
+		eth.run(&batch, any != 0);
+		frames[any] = chip.frames - f;
+		for(int i=0; i<8; i++) check(chip.bank[(regs[i] & ENC28J60::BANK_MASK) >> 5][regs[i] & ENC28J60::ADDR_MASK] == 0x10 * any + i, "batch register written");
+	}
+	printf("batch of 8 over 4 banks: %ld frames in order, %ld in any order\n", frames[0], frames[1]);
+	check(frames[1] < frames[0], "any order batch saves bank switches");
+	eth.write_reg_byte(ENC28J60::MAADR3, eth.mac_address[2]);
+	eth.write_reg_byte(ENC28J60::MAADR4, eth.mac_address[3]);
+}
+
+static void test_receive() {
+	byte f[1024];
+	check(eth.rx_begin() == 0, "nothing received yet");
+	long sequential = 0;
+	// round the ring several times, so packets straddle the end of it
+	for(int n=0; n<400; n++) {
+		word length = make_packet(f, n);
+		chip.inject(f, length);
+		if(eth.rx_begin() != length) { check(false, "rx_begin length"); return; }
+		ENC28J60Page page(&eth);
+		long w = chip.erdpt_writes;
+		bool same = true;
+		for(int i=0; i<length; i++) same = same && (page.read_byte(i) == f[i]);
+		sequential += chip.erdpt_writes - w;
+		check(same, "packet read in place");
+		// and from part way in
+		ENC28J60Page tail(&eth, 10);
+		check(tail.length() == length - 10, "page offset length");
+		byte b[20];
+		eth.rx_read(length - 20, b, 20);
+		check(!memcmp(b, f + length - 20, 20), "rx_read at the end");
+		eth.rx_end();
+		check(chip.packet_count() == 0, "rx_end decrements");
+		check(chip.reg_word(0, 0x0C) & 1, "ERXRDPT odd");
+	}
+	printf("receive: ERDPT written %ld times for byte by byte reads of 400 packets\n", sequential);
+	check(sequential == 0, "ERDPT left alone for sequential reads");
+}
+
+static void test_transmit() {
+	byte f[200];
+	for(int i=0; i<200; i++) f[i] = rand();
+	check(eth.tx_begin(), "tx_begin");
+	byte blank[4] = { 0, 0, 0, 0 };
+	eth.tx_write(f, 20);
+	eth.tx_write(blank, 4);
+	eth.tx_write(f + 24, 176);
+	eth.tx_write_at(20, f + 20, 4);
+	check(eth.tx_length() == 200, "tx_length");
+	// the checksum of an odd length run
+	unsigned long sum = 0;
+	for(int i=0; i<151; i++) sum += (i & 1) ? f[14 + i] : (f[14 + i] << 8);
+	while(sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+	word checksum = 0;
+	check(eth.tx_checksum(14, 151, &checksum) && checksum == (word)~sum, "DMA checksum");
+	// a DMA engine that never finishes - the wait times out, and the engine is stopped
+	chip.dma_stuck = true;
+	check(!eth.tx_checksum(14, 151, &checksum), "DMA timeout reported");
+	check(!(chip.bank[0][0x1F] & (ENC28J60::ECON1_DMAST | ENC28J60::ECON1_CSUMEN)), "DMAST and CSUMEN cleared after a timeout");
+	chip.dma_stuck = false;
+	byte back[200];
+	eth.tx_read(0, back, 200);
+	check(!memcmp(back, f, 200), "tx_read");
+	eth.tx_send();
+	check(chip.sent.size() == 1 && chip.sent[0].size() == 200 && !memcmp(&chip.sent[0][0], f, 200), "frame sent");
+	check(!eth.tx_busy(), "transmit finished");
+}
+
+// the INT pin, as the external interrupt sees it - a falling edge sets the flag
+static bool int_level = false, int_flag = false;
+static int fired_deferred = 0, fired_direct = 0;
+static int next_seq = 0;
+
+static void interrupt(bool mid_frame) {
+	// packets keep arriving
+	if(chip.packet_count() < 5 && rand() % 2000 == 0) {
+		byte f[1024];
+		word length = make_packet(f, next_seq++);
+		chip.inject(f, length);
+	}
+	bool level = chip.int_line();
+	if(level && !int_level) int_flag = true;
+	int_level = level;
+	if(int_flag && rand() % 3 == 0) {
+		int_flag = false;
+		if(mid_frame) fired_deferred++; else fired_direct++;
+		eth.rx_interrupt();
+		int_level = chip.int_line();
+	}
+}
+static void during_frame() { interrupt(true); }
+
+static void test_interrupt_receive() {
+	ENC28J60Packet pool[4];
+	HALQueue packets, spare;
+	for(int i=0; i<4; i++) { pool[i].next = 0; spare.enqueue(&pool[i]); }
+	eth.rx_queue(&packets, &spare);
+	chip.during = during_frame;
+	int expect = 0;
+	byte f[1024];
+	for(long n=0; n<2000000 && expect<3000; n++) {
+		interrupt(false);
+		// other traffic, in another bank
+		if(eth.read_reg_byte(ENC28J60::MAADR1) != eth.mac_address[0]) { check(false, "bank put back"); break; }
+		ENC28J60Packet * p = (ENC28J60Packet *)packets.dequeue();
+		if(!p) continue;
+		eth.rx_select(p);
+		word length = make_packet(f, expect);
+		if(p->length != length) { check(false, "queued packet length"); break; }
+		ENC28J60Page page(&eth);
+		bool same = true;
+		for(int i=0; i<length; i++) same = same && (page.read_byte(i) == f[i]);
+		if(!same) { check(false, "queued packet contents"); break; }
+		eth.rx_release(p);
+		expect++;
+	}
+	chip.during = 0;
+	printf("interrupt receive: %d packets, interrupt fired %d times mid-frame and %d between calls\n", expect, fired_deferred, fired_direct);
+	check(expect == 3000, "every packet received");
+	check(fired_deferred > 0 && fired_direct > 0, "both interrupt paths taken");
+	check(chip.nested == 0, "interrupt kept off the bus mid-frame");
+}
+
+int main(int argc, char ** argv) {
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+	for(int i=0; i<HOST_PORTS; i++) fake_ports[i] = 0xFF;
+	chip.attach();
+	test_start();
+	test_batch();
+	test_receive();
+	test_transmit();
+	test_interrupt_receive();
+	if(failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
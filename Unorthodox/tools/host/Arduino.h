@@ -0,0 +1,106 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  Arduino.h stand-in, so the unorthodox headers can be built and exercised on the desktop by
+  the tools in the directory above. Just enough of the core to compile: types, PROGMEM reads,
+  a Print/Stream that writes to stdout, and empty pin and interrupt calls.
+
+  micros() counts up by one per call rather than keeping time. A tool which wants timings
+  should use the host clock directly. millis() does follow the host clock, so that driver
+  timeouts still run out.
+
+  Pointer-linked trees (Map, CountedMap) keep node pointers in 'word' links, which only works
+  when a word can hold a pointer. Build anything that includes unorthodox_trees.h with
+  -DHOST_WIDE_WORD to widen it. Everything else wants the real 16-bit word.
+
+  The including program must define 'Stream Serial;' and 'uint8_t SREG;' once.
+ */
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef HOST_WIDE_WORD
+typedef uintptr_t word;
+#else
+typedef uint16_t word;
+#endif
+typedef uint8_t byte;
+typedef bool boolean;
+typedef unsigned char prog_uchar;
+typedef uint8_t prog_uint8_t;
+typedef uint16_t prog_uint16_t;
+
+#define PROGMEM
+#define pgm_read_byte_near(p) (*(const uint8_t*)(p))
+#define pgm_read_word_near(p) (*(const uint16_t*)(p))
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+#define INPUT_PULLUP 2
+#define HEX 16
+#define DEC 10
+#define MSBFIRST 1
+
+#ifndef min
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#endif
+#define constrain(x,a,b) ((x)<(a)?(a):((x)>(b)?(b):(x)))
+
+#define F_CPU 16000000UL
+
+#define cli()
+#define sei()
+inline void noInterrupts() {}
+inline void interrupts() {}
+#define ISR(v) void v(void)
+extern uint8_t SREG;
+
+inline unsigned long millis() { timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return t.tv_sec * 1000UL + t.tv_nsec / 1000000; }
+inline unsigned long micros() { static unsigned long t; return t++; }
+inline void delay(unsigned long) {}
+inline void delayMicroseconds(unsigned int) {}
+inline void digitalWrite(int, int) {}
+inline int digitalRead(int) { return 0; }
+inline void pinMode(int, int) {}
+inline void shiftOut(int, int, int, int) {}
+inline long random(long a) { return rand() % a; }
+inline long random(long a, long b) { return a + rand() % (b - a); }
+inline char * itoa(int v, char * s, int base) { sprintf(s, (base==HEX) ? "%x" : "%d", v); return s; }
+inline char * ltoa(long v, char * s, int base) { sprintf(s, (base==HEX) ? "%lx" : "%ld", v); return s; }
+inline char * ultoa(unsigned long v, char * s, int base) { sprintf(s, (base==HEX) ? "%lx" : "%lu", v); return s; }
+
+class Print {
+public:
+	virtual size_t write(uint8_t c) { putchar(c); return 1; }
+	size_t print(const char * s) { size_t n = 0; while(*s) n += write(*s++); return n; }
+	size_t print(char c) { return write(c); }
+	size_t print(int v, int base = DEC) { char t[32]; snprintf(t, 32, (base==HEX) ? "%x" : "%d", v); return print(t); }
+	size_t print(unsigned int v, int base = DEC) { char t[32]; snprintf(t, 32, (base==HEX) ? "%x" : "%u", v); return print(t); }
+	size_t print(long v, int base = DEC) { char t[32]; snprintf(t, 32, (base==HEX) ? "%lx" : "%ld", v); return print(t); }
+	size_t print(unsigned long v, int base = DEC) { char t[32]; snprintf(t, 32, (base==HEX) ? "%lx" : "%lu", v); return print(t); }
+	size_t println(const char * s = "") { return print(s) + print("\n"); }
+};
+
+class Stream : public Print {
+public:
+	void begin(unsigned long) {}
+	operator bool() { return true; }
+	virtual int available() { return 0; }
+	virtual int read() { return -1; }
+	virtual int peek() { return -1; }
+};
+
+extern Stream Serial;
+
+#endif
@@ -0,0 +1,51 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  SPI.h stand-in for the host tools. The SPI registers and the output port registers are plain
+  bytes, so a tool can play the part of the bus: read SPDR for the byte the master sent, put the
+  slave's reply back in SPDR, and look at fake_ports to see which chip is selected. Pin n is bit
+  (n % 8) of fake_ports[n / 8].
+
+  SPI.transfer() hands each byte to the 'responder' function, if the tool has set one, and
+  returns its reply.
+
+  The including program must define the registers, fake_ports and SPI once:
+
+    volatile uint8_t SPCR, SPDR, SPSR;
+    volatile uint8_t fake_ports[HOST_PORTS];
+    SPIClass SPI;
+ */
+#ifndef _SPI_H_INCLUDED
+#define _SPI_H_INCLUDED
+
+#define SPIE 7
+#define SPE 6
+#define MSTR 4
+#define SPIF 7
+
+#define SPI_MODE0 0
+#define SPI_CLOCK_DIV2 0
+#define SPI_CLOCK_DIV4 0
+#define SPI_CLOCK_DIV64 0
+
+extern volatile uint8_t SPCR, SPDR, SPSR;
+
+#define HOST_PORTS 8
+extern volatile uint8_t fake_ports[HOST_PORTS];
+#define digitalPinToPort(p) ((p) / 8)
+#define digitalPinToBitMask(p) (1 << ((p) % 8))
+#define portOutputRegister(x) (&fake_ports[x])
+
+class SPIClass {
+public:
+	uint8_t (*responder)(uint8_t b);
+	void begin() {}
+	void setBitOrder(int) {}
+	void setDataMode(int) {}
+	void setClockDivider(int) {}
+	uint8_t transfer(uint8_t b) { return responder ? responder(b) : 0; }
+};
+
+extern SPIClass SPI;
+
+#endif
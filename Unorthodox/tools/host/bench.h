@@ -0,0 +1,63 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  The timing harness shared by the map and tree benchmarks in the directory above. Include it
+  after Arduino.h.
+
+  Each benchmark times insert, seek and remove passes over the same shuffled keys, for every
+  map it compares, and repeats that BENCH_ROUNDS times with the maps interleaved - so any slow
+  patch on the host hits them all alike. Timing::best() keeps the quickest round of each, which
+  is the one least disturbed by the host:
+
+    Timing a, b;
+    for(int round = 0; round < BENCH_ROUNDS; round++) {
+      Timing t1, t2;
+      time_a(keys, count, reps, t1); a.best(t1);
+      time_b(keys, count, reps, t2); b.best(t2);
+    }
+ */
+#ifndef HOST_BENCH_H
+#define HOST_BENCH_H
+
+#include <time.h>
+
+static const int BENCH_ROUNDS = 7;
+
+// results go here, so the optimizer can't drop the work
+static volatile word sink;
+
+// the host clock, in seconds
+static double now() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// timings for insert, seek and remove, in seconds
+struct Timing {
+	double insert, seek, remove;
+	Timing() { insert = seek = remove = 0; }
+	// add one pass, from the times taken before and after each stage
+	void add(double a, double b, double c, double d) {
+		insert += b - a;
+		seek += c - b;
+		remove += d - c;
+	}
+	// keep the quickest of several rounds
+	void best(Timing & t) {
+		if(insert==0 || t.insert < insert) insert = t.insert;
+		if(seek==0 || t.seek < seek) seek = t.seek;
+		if(remove==0 || t.remove < remove) remove = t.remove;
+	}
+};
+
+// the keys 0..count-1, in random order
+static void shuffle_keys(word * keys, int count) {
+	for(int i = 0; i < count; i++) keys[i] = i;
+	for(int i = count - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		word k = keys[i]; keys[i] = keys[j]; keys[j] = k;
+	}
+}
+
+#endif
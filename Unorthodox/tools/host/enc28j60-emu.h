@@ -0,0 +1,229 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  ENC28J60 stand-in for the host tools. A model of the chip's registers and 8K buffer which
+  answers the driver's SPI frames through the SPI.h stand-in, so the real ENC28J60 class (and
+  anything built on it) can be run on the desktop.
+
+  Frames are found from the chip select pin: a byte that arrives with the pin low starts a new
+  frame, and the model raises the pin again itself after every byte. So a byte with the pin
+  still high carries on the frame, until the driver deselects and selects again.
+
+  Modelled: the banked control registers, the MII registers (with the dummy byte on reads) and
+  PHY registers, buffer reads and writes with ERDPT wrapping around the receive ring, the DMA
+  checksum, transmit (each frame sent is kept in 'sent'), PKTDEC and the soft reset. Anything
+  else just reads back what was written. DMA and PHY operations finish instantly, unless
+  'dma_stuck' is set, in which case DMAST never clears.
+
+  inject() puts a packet in the receive ring, the way the chip would. The test must not inject
+  more than the ring has room for - there's no overflow model.
+
+  int_line() is the level of the chip's INT pin (true = asserted). 'during' is called after
+  every byte, in the middle of whatever frame the driver is sending, which is where a tool can
+  fire the driver's interrupt. If the bus is used from in there, 'nested' counts it.
+
+    ENC28J60Emulator chip(10);
+    chip.attach();
+    ENC28J60 eth(10);
+    eth.start();
+ */
+#ifndef HOST_ENC28J60_EMU_H
+#define HOST_ENC28J60_EMU_H
+
+#include <vector>
+
+class ENC28J60Emulator {
+public:
+	byte bank[4][32];  // control registers. 0x1B-0x1F are the same in every bank, and live in bank 0
+	word phy[32];
+	byte mem[8192];
+	word rx_write;     // where the next packet goes (the chip's ERXWRPT)
+	std::vector<std::vector<byte> > sent;
+	bool dma_stuck;
+	void (*during)();
+	// traffic counters
+	long frames, bytes, erdpt_writes, dma_runs, nested;
+
+	// constructor
+	ENC28J60Emulator(int pin) {
+		port = portOutputRegister(digitalPinToPort(pin));
+		mask = digitalPinToBitMask(pin);
+		dma_stuck = false;
+		during = 0;
+		depth = 0;
+		frames = 0;
+		bytes = 0;
+		erdpt_writes = 0;
+		dma_runs = 0;
+		nested = 0;
+		memset(phy, 0, sizeof(phy));
+		memset(mem, 0, sizeof(mem));
+		reset();
+	}
+
+	// become the chip on the bus
+	void attach() {
+		instance = this;
+		SPI.responder = respond;
+		*port |= mask;
+	}
+
+	// a register by its bank and address, for the tool to look at
+	word reg_word(byte b, byte address) { return bank[b][address] | (bank[b][address+1] << 8); }
+	byte packet_count() { return bank[1][0x19]; }
+	bool int_line() { return (bank[0][EIE] & 0xC0) == 0xC0 && packet_count() > 0; }
+
+	// receive a frame (without the CRC, which is added as zeroes)
+	void inject(const byte * frame, word length) {
+		word rxst = reg_word(0, 0x08), rxnd = reg_word(0, 0x0A);
+		word size = rxnd + 1 - rxst;
+		word next = rx_write + 6 + length + 4;
+		if(next & 1) next++;
+		if(next > rxnd) next -= size;
+		byte header[6] = { (byte)next, (byte)(next >> 8), (byte)(length + 4), (byte)((length + 4) >> 8), 0x80, 0 };
+		word p = rx_write;
+		for(int i=0; i<6 + length + 4; i++) {
+			byte b = (i < 6) ? header[i] : (i < 6 + length) ? frame[i - 6] : 0;
+			mem[p & 8191] = b;
+			p = (p == rxnd) ? rxst : p + 1;
+		}
+		rx_write = next;
+		bank[1][0x19]++;
+		bank[0][EIR] |= 0x40; // PKTIF
+	}
+
+private:
+	static ENC28J60Emulator * instance;
+	volatile uint8_t * port;
+	byte mask;
+	int depth;
+	// frame state
+	enum { START, IGNORE, DUMMY, READ_REG, WRITE_ARG, READ_BUFFER, WRITE_BUFFER };
+	int state;
+	byte op;
+	byte address;
+
+	static const byte EIE = 0x1B, EIR = 0x1C, ESTAT = 0x1D, ECON2 = 0x1E, ECON1 = 0x1F;
+
+	void reset() {
+		memset(bank, 0, sizeof(bank));
+		bank[0][ESTAT] = 0x01;  // CLKRDY
+		bank[0][ECON2] = 0x80;  // AUTOINC
+		bank[0][0x0A] = 0xFF;   // ERXND
+		bank[0][0x0B] = 0x1F;
+		bank[3][0x12] = 0x06;   // EREVID
+		rx_write = 0;
+		state = IGNORE;
+	}
+
+	int current_bank() { return bank[0][ECON1] & 3; }
+	byte & reg(byte a) { return (a >= 0x1B) ? bank[0][a] : bank[current_bank()][a]; }
+	// MAC and MII registers send a dummy byte before the data
+	bool mac_mii(byte a) {
+		int b = current_bank();
+		return (b == 2 && a <= 0x19) || (b == 3 && (a <= 0x05 || a == 0x0A));
+	}
+	void set_word(byte b, byte a, word v) { bank[b][a] = v & 0xFF; bank[b][a+1] = v >> 8; }
+
+	void written(byte a, byte v) {
+		int b = current_bank();
+		if(b == 0 && (a == 0x00 || a == 0x01)) erdpt_writes++;
+		// MICMD.MIIRD - read a PHY register
+		if(b == 2 && a == 0x12 && (v & 1)) set_word(2, 0x18, phy[bank[2][0x14] & 31]);
+		// MIWRH - write a PHY register
+		if(b == 2 && a == 0x17) phy[bank[2][0x14] & 31] = reg_word(2, 0x16);
+		if(a == ECON1) econ1();
+		// ECON2.PKTDEC
+		if(a == ECON2 && (v & 0x40)) {
+			if(bank[1][0x19]) bank[1][0x19]--;
+			bank[0][ECON2] &= ~0x40;
+			if(!bank[1][0x19]) bank[0][EIR] &= ~0x40;
+		}
+	}
+
+	void econ1() {
+		byte & e = bank[0][ECON1];
+		// DMAST with CSUMEN - the checksum from EDMAST to EDMAND
+		if((e & 0x20) && (e & 0x10) && !dma_stuck) {
+			dma_runs++;
+			word st = reg_word(0, 0x10), nd = reg_word(0, 0x12);
+			unsigned long sum = 0;
+			int n = 0;
+			for(word p=st; ; p++) {
+				sum += (n & 1) ? mem[p & 8191] : (mem[p & 8191] << 8);
+				n++;
+				if(p == nd) break;
+			}
+			while(sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+			set_word(0, 0x16, (word)~sum);
+			e &= ~0x20;
+		}
+		// TXRTS - send ETXST+1 to ETXND (the first byte is the control byte)
+		if(e & 0x08) {
+			word st = reg_word(0, 0x04), nd = reg_word(0, 0x06);
+			sent.push_back(std::vector<byte>(mem + st + 1, mem + nd + 1));
+			e &= ~0x08;
+			bank[0][EIR] |= 0x08; // TXIF
+		}
+	}
+
+	byte transfer(byte b) {
+		bytes++;
+		switch(state) {
+			case START:
+				op = b & 0xE0;
+				address = b & 0x1F;
+				if(b == 0xFF) { reset(); return 0; }
+				if(b == 0x3A) { state = READ_BUFFER; return 0; }
+				if(b == 0x7A) { state = WRITE_BUFFER; return 0; }
+				if(op == 0x00) { state = mac_mii(address) ? DUMMY : READ_REG; return 0; }
+				state = WRITE_ARG;
+				return 0;
+			case DUMMY:
+				state = READ_REG;
+				return 0;
+			case READ_REG:
+				state = IGNORE;
+				return reg(address);
+			case WRITE_ARG:
+				state = IGNORE;
+				if(op == 0x40) reg(address) = b;
+				else if(op == 0x80) reg(address) |= b;
+				else if(op == 0xA0) reg(address) &= ~b;
+				written(address, b);
+				return 0;
+			case READ_BUFFER: {
+				word p = reg_word(0, 0x00);
+				byte r = mem[p & 8191];
+				set_word(0, 0x00, (p == reg_word(0, 0x0A)) ? reg_word(0, 0x08) : p + 1);
+				return r;
+			}
+			case WRITE_BUFFER: {
+				word p = reg_word(0, 0x02);
+				mem[p & 8191] = b;
+				set_word(0, 0x02, p + 1);
+				return 0;
+			}
+		}
+		return 0;
+	}
+
+	static uint8_t respond(uint8_t b) {
+		ENC28J60Emulator * chip = instance;
+		if(chip->depth) chip->nested++;
+		chip->depth++;
+		if(!(*chip->port & chip->mask)) {
+			chip->frames++;
+			chip->state = START;
+		}
+		byte r = chip->transfer(b);
+		*chip->port |= chip->mask;
+		if(chip->during) chip->during();
+		chip->depth--;
+		return r;
+	}
+};
+
+ENC28J60Emulator * ENC28J60Emulator::instance = 0;
+
+#endif
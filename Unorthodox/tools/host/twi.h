@@ -0,0 +1,46 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  TWI (I2C) register stand-ins for the host tools, which the real avr/io.h would otherwise
+  provide. Include it before the unorthodox headers, so the TWIEngine gets declared.
+
+  TWSR, TWDR and TWBR are plain bytes. TWCR is an object, so a tool can play the part of the
+  hardware: every write to it goes to the 'written' function and every read to the 'read'
+  function, if the tool has set them, and to 'value' if not.
+
+  The including program must define the registers once:
+
+    uint8_t TWSR, TWDR, TWBR;
+    HostTWCR host_twcr;
+ */
+#ifndef HOST_TWI_H
+#define HOST_TWI_H
+
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWEN 2
+#define TWIE 0
+
+static const uint8_t SDA = 2;
+static const uint8_t SCL = 3;
+
+extern uint8_t TWSR, TWDR, TWBR;
+
+class HostTWCR {
+public:
+	uint8_t value;
+	void (*written)(uint8_t v);
+	uint8_t (*read)();
+	operator uint8_t() { return read ? read() : value; }
+	HostTWCR & operator=(uint8_t v) {
+		if(written) written(v); else value = v;
+		return *this;
+	}
+};
+
+extern HostTWCR host_twcr;
+#define TWCR host_twcr
+
+#endif
@@ -0,0 +1,102 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  keyfs-test : host-side check of KeyFS against std::map, over random writes and erases into a
+  small EEPROM image that keeps running out of journal space.
+
+  Whatever key_write() returns has to be the truth: after a true every key reads back as
+  written, and after a false every key reads back as it was before - including when a bucket
+  split gets its upper half into the journal and not the lower one. Every so often the store
+  is started again from the image, and has to come back with the same keys.
+
+    g++ -O2 -I host -I ../arch/avr -o keyfs-test keyfs-test.cpp
+    ./keyfs-test [seed]
+ */
+
+#include <map>
+#include <vector>
+#include <Arduino.h>
+#include <unorthodox_page.h>
+
+Stream Serial;
+uint8_t SREG;
+
+typedef std::map< word, std::vector<byte> > Model;
+
+static const word STORAGE = 1024;
+static const word BUCKETS = 25;
+static const byte BUCKET_MAX = 64;
+
+static byte storage[STORAGE];
+static int failures = 0;
+
+static void check(bool ok, const char * what) {
+	if(!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+// does the store hold exactly what the model says?
+static bool same(KeyFS & fs, Model & model, word keys) {
+	for(word key = 0; key < keys; key++) {
+		Model::iterator m = model.find(key);
+		word p = fs.key_find(key);
+		if(m == model.end()) {
+			if(p) return false;
+			continue;
+		}
+		if(!p || fs.key_size(key) != m->second.size()) return false;
+		for(size_t i = 0; i < m->second.size(); i++) {
+			if(fs.page->read_byte(p + i) != m->second[i]) return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+	MemoryPage store(storage);
+	memset(storage, 0, sizeof(storage));
+	KeyFS * fs = new KeyFS(&store, STORAGE, BUCKETS, BUCKET_MAX);
+	fs->start();
+	Model model;
+	word keys = 80;
+	int writes = 0, refused = 0, restarts = 0;
+	byte value[BUCKET_MAX];
+	for(int op = 0; op < 50000 && !failures; op++) {
+		word key = rand() % keys;
+		byte count = (rand() % 4 == 0) ? 0 : 1 + rand() % ((BUCKET_MAX >> 1) - 4);
+		for(int i = 0; i < count; i++) value[i] = rand();
+		MemoryPage source(value);
+		if(fs->key_write(key, &source, count)) {
+			writes++;
+			if(count) model[key] = std::vector<byte>(value, value + count);
+			else model.erase(key);
+		} else {
+			refused++;
+		}
+		if(!same(*fs, model, keys)) {
+			printf("  op %d: key %d, %d bytes\n", op, key, count);
+			check(false, "store matches what key_write() said it did");
+		}
+		if(op % 500 == 499) {
+			// start over from the image
+			delete fs;
+			fs = new KeyFS(&store, STORAGE, BUCKETS, BUCKET_MAX);
+			fs->start();
+			restarts++;
+			check(same(*fs, model, keys), "same keys after a restart");
+		}
+	}
+	printf("%d writes taken, %d refused, %d restarts, %d keys live in %d buckets\n",
+		writes, refused, restarts, (int)model.size(), (int)fs->bucket_count);
+	check(refused > 0, "the journal filled up");
+	delete fs;
+	if(failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
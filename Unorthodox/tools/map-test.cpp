@@ -0,0 +1,202 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  map-test : host-side check of Map and CountedMap against std::set, over random keys.
+
+  Two CountedMaps share a pool and are filled from overlapping key ranges, so there are plenty
+  of duplicates, then merged. After the merge, and again after erasing a random half of what's
+  left, both maps are walked and checked against the sets they should hold:
+
+    - the keys, in order, and the red-black and parent-link invariants
+    - every subtree count, and count(), rank(), select() and count_range() - including
+      ranges that run past the top of the key range
+    - merge() returns the number of duplicates, which stay behind in the other map
+
+  Then a plain Map is filled through MapTree (the RedBlackTree adapter), and emptied through
+  the Map itself.
+
+    g++ -O2 -DHOST_WIDE_WORD -I host -I ../arch/avr -o map-test map-test.cpp
+    ./map-test [seed]
+
+  (HOST_WIDE_WORD because Map keeps pointers in word links.)
+ */
+
+#include <set>
+#include <vector>
+#include <Arduino.h>
+#include <unorthodox_page.h>
+#include <unorthodox_trees.h>
+
+Stream Serial;
+uint8_t SREG;
+
+typedef std::set<word> KeySet;
+
+static int failures = 0;
+
+static void check(bool ok, const char * what) {
+	if(!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+// walk a subtree, checking the links, colours and counts. Returns the black height, or -1.
+static int check_subtree(MapNode * n, MapNode * parent, bool counted, std::vector<word> & keys) {
+	if(n==0) return 0;
+	if((MapNode *)n->parent != parent) return -1;
+	bool red = n->meta & 0x8000;
+	MapNode * l = (MapNode *)n->left;
+	MapNode * r = (MapNode *)n->right;
+	if(red && ((l && (l->meta & 0x8000)) || (r && (r->meta & 0x8000)))) return -1;
+	int lh = check_subtree(l, n, counted, keys);
+	keys.push_back(n->get_key());
+	int rh = check_subtree(r, n, counted, keys);
+	if(lh < 0 || lh != rh) return -1;
+	if(counted) {
+		word c = 1 + (l ? ((CountedMapNode *)l)->count : 0) + (r ? ((CountedMapNode *)r)->count : 0);
+		if(((CountedMapNode *)n)->count != c) return -1;
+	}
+	return lh + (red ? 0 : 1);
+}
+
+// the root, found by climbing from the first node
+static MapNode * root_of(MapNode * n) {
+	while(n && n->parent) n = (MapNode *)n->parent;
+	return n;
+}
+
+static void check_shape(MapNode * first, bool counted, KeySet & expect, const char * what) {
+	MapNode * root = root_of(first);
+	std::vector<word> keys;
+	bool ok = check_subtree(root, 0, counted, keys) >= 0 && (root==0 || !(root->meta & 0x8000));
+	if(!ok) printf("  %s: tree broken\n", what);
+	check(ok, "red-black invariants, parent links and counts");
+	check(keys == std::vector<word>(expect.begin(), expect.end()), "keys match the set");
+}
+
+static word set_rank(KeySet & s, word key) {
+	return std::distance(s.begin(), s.lower_bound(key));
+}
+
+static word set_range(KeySet & s, word lo, word hi) {
+	if(hi < lo) return 0;
+	return std::distance(s.lower_bound(lo), s.upper_bound(hi));
+}
+
+static void check_counts(CountedMap & map, KeySet & expect, word span) {
+	check(map.count() == expect.size(), "count");
+	word k = 0;
+	bool ok = true;
+	for(KeySet::iterator i = expect.begin(); i != expect.end(); i++, k++) {
+		CountedMapNode * n = map.select(k);
+		ok = ok && n && n->get_key() == *i;
+	}
+	ok = ok && map.select(k) == 0;
+	check(ok, "select");
+	ok = true;
+	for(int i = 0; i < 200; i++) {
+		word key = rand() % (span + 2);
+		ok = ok && map.rank(key) == set_rank(expect, key);
+	}
+	check(ok, "rank");
+	ok = true;
+	for(int i = 0; i < 200; i++) {
+		word lo = rand() % (span + 2);
+		word hi = lo + rand() % (span / 4 + 1) - span / 16;
+		ok = ok && map.count_range(lo, hi) == set_range(expect, lo, hi);
+	}
+	check(ok, "count_range");
+	check(map.count_range(0, 0xFFFF) == expect.size(), "count_range to 0xFFFF");
+	check(map.count_range(span / 2, 0xFFFF) == set_range(expect, span / 2, 0x7FFF), "count_range from the middle to 0xFFFF");
+	check(map.count_range(0x7FFF, 0x7FFF) == expect.count(0x7FFF), "count_range of the top key");
+	check(map.count_range(0x8000, 0xFFFF) == 0, "count_range above the key range");
+}
+
+static void fill(CountedMap & map, KeySet & s, int n, word lo, word hi) {
+	for(int i = 0; i < n; i++) {
+		word key = lo + rand() % (hi - lo + 1);
+		check(map.insert(key) != 0, "insert");
+		s.insert(key);
+	}
+}
+
+static void test_merge(int round) {
+	// the upper keys only turn up in some rounds, so the top of the range gets tested too
+	word span = (round % 3 == 0) ? 0x7FFF : 2000;
+	int na = rand() % 600, nb = rand() % 600;
+	MapPool pool(sizeof(CountedMapNode), na + nb + 1);
+	CountedMap a(&pool), b(&pool);
+	KeySet sa, sb;
+	fill(a, sa, na, 0, span * 2 / 3);
+	fill(b, sb, nb, span / 3, span);
+	if(round % 3 == 0) {
+		check(b.insert(0x7FFF) != 0, "insert the top key");
+		sb.insert(0x7FFF);
+	}
+	check_shape(a.first(), true, sa, "before merge");
+	check_counts(a, sa, span);
+
+	KeySet all = sa, dups;
+	all.insert(sb.begin(), sb.end());
+	for(KeySet::iterator i = sb.begin(); i != sb.end(); i++) if(sa.count(*i)) dups.insert(*i);
+	word d = a.merge(&b);
+	check(d == dups.size(), "merge returns the duplicates");
+	check_shape(a.first(), true, all, "merged");
+	check_shape(b.first(), true, dups, "left behind");
+	check_counts(a, all, span);
+	check_counts(b, dups, span);
+
+	// the merged map still works, and its nodes all go back to the one pool
+	std::vector<word> keys(all.begin(), all.end());
+	for(size_t i = 0; i < keys.size(); i++) {
+		if(rand() & 1) continue;
+		check(a.erase(keys[i]), "erase after merge");
+		all.erase(keys[i]);
+	}
+	check_shape(a.first(), true, all, "erased");
+	check_counts(a, all, span);
+	while(a.first()) a.erase(a.first()->get_key());
+	while(b.first()) b.erase(b.first()->get_key());
+	check(pool.used == 0, "every node back in the pool");
+}
+
+static void test_map_tree() {
+	MapPool pool(sizeof(MapNode), 500);
+	Map map(&pool);
+	MapTree tree(&map);
+	KeySet s;
+	for(int i = 0; i < 500; i++) {
+		word key = rand() % 1000;
+		if(tree.tree_seek_node(key, RedBlackTree::MATCH_EXACT)) continue;
+		MapNode * n = pool.alloc();
+		n->set_key(key);
+		tree.tree_insert_node((word)n);
+		s.insert(key);
+	}
+	check_shape(map.first(), false, s, "filled through MapTree");
+	bool ok = true;
+	for(word key = 0; key < 1000; key++) ok = ok && (map.seek(key) != 0) == (s.count(key) != 0);
+	check(ok, "Map sees what MapTree inserted");
+	std::vector<word> keys(s.begin(), s.end());
+	for(size_t i = 0; i < keys.size(); i += 2) {
+		check(map.erase(keys[i]), "erase through the Map");
+		s.erase(keys[i]);
+	}
+	ok = true;
+	for(word key = 0; key < 1000; key++) ok = ok && (tree.tree_seek_node(key, RedBlackTree::MATCH_EXACT) != 0) == (s.count(key) != 0);
+	check(ok, "MapTree sees what the Map erased");
+	check_shape(map.first(), false, s, "erased through the Map");
+}
+
+int main(int argc, char ** argv) {
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+	for(int round = 0; round < 200 && failures == 0; round++) test_merge(round);
+	test_map_tree();
+	if(failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,286 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  netstack-test : host-side check of NetStack, running on the real ENC28J60 driver against the
+  emulated chip in host/enc28j60-emu.h. Frames are injected into the chip's receive ring and
+  taken from what it sends.
+
+    - ARP requests for us are answered, and the sender is learned
+    - UDP datagrams go out with the right headers and checksums, odd and even lengths, with the
+      DMA checksum engine and without it - and when the DMA engine never finishes
+    - datagrams off the local network ARP for the gateway (rate limited) and go to it, and a
+      stream of senders from off the network doesn't push the gateway out of the cache
+    - an ARP request that arrives while a datagram is half written is answered after it's sent,
+      and doesn't disturb it
+    - datagrams are delivered to the bound socket, bad IP checksums dropped, and a socket can
+      reply from inside receive()
+    - the same through rx_interrupt() and poll(&packets)
+
+    g++ -O2 -I host -I ../arch/avr -o netstack-test netstack-test.cpp
+    ./netstack-test
+ */
+
+#include <vector>
+#include <Arduino.h>
+#include <SPI.h>
+#include <unorthodox_page.h>
+#include <unorthodox_queues.h>
+#include <unorthodox_device.h>
+#include <unorthodox_drivers_spi.h>
+#include <unorthodox_net.h>
+#include <enc28j60-emu.h>
+
+Stream Serial;
+uint8_t SREG;
+volatile uint8_t SPCR, SPDR, SPSR;
+volatile uint8_t fake_ports[HOST_PORTS];
+SPIClass SPI;
+
+typedef std::vector<byte> Frame;
+
+static const int PIN = 10;
+static ENC28J60Emulator chip(PIN);
+static ENC28J60 eth(PIN);
+static int failures = 0;
+
+static byte me[4] = { 192, 168, 1, 50 };
+static byte host[4] = { 192, 168, 1, 10 };
+static byte other[4] = { 192, 168, 1, 77 };
+static byte gw[4] = { 192, 168, 1, 1 };
+static byte far[4] = { 8, 8, 8, 8 };
+static byte bc[4] = { 255, 255, 255, 255 };
+static byte host_mac[6] = { 2, 0, 0, 0, 0, 10 };
+static byte other_mac[6] = { 2, 0, 0, 0, 0, 77 };
+static byte gw_mac[6] = { 2, 0, 0, 0, 0, 1 };
+static byte ff[6] = { 255, 255, 255, 255, 255, 255 };
+static byte zero[6] = { 0, 0, 0, 0, 0, 0 };
+
+static void check(bool ok, const char * what) {
+	if(!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static word get16(const Frame & f, int at) { return (f[at] << 8) | f[at+1]; }
+
+static word checksum(const byte * p, int n, unsigned long sum) {
+	for(int i=0; i<n; i++) sum += (i & 1) ? p[i] : (p[i] << 8);
+	while(sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+	return ~sum;
+}
+
+// a UDP frame as sent, with every header field and both checksums right
+static bool good_udp(const Frame & f, const byte * to_mac, const byte * to, word sport, word dport, const void * payload, int n) {
+	if(f.size() != (size_t)(42 + n)) return false;
+	if(memcmp(&f[0], to_mac, 6) || memcmp(&f[6], eth.mac_address, 6) || get16(f, 12) != 0x0800) return false;
+	if(f[14] != 0x45 || get16(f, 16) != 28 + n || f[23] != 17 || checksum(&f[14], 20, 0) != 0) return false;
+	if(memcmp(&f[26], me, 4) || memcmp(&f[30], to, 4)) return false;
+	if(get16(f, 34) != sport || get16(f, 36) != dport || get16(f, 38) != 8 + n) return false;
+	if(n && memcmp(&f[42], payload, n)) return false;
+	// the pseudo-header, then the UDP header and payload
+	unsigned long pseudo = 17 + 8 + n;
+	for(int i=0; i<8; i+=2) pseudo += get16(f, 26 + i);
+	return get16(f, 40) != 0 && checksum(&f[34], 8 + n, pseudo) == 0;
+}
+
+static Frame ether(const byte * to, const byte * from, word type) {
+	Frame f(to, to + 6);
+	f.insert(f.end(), from, from + 6);
+	f.push_back(type >> 8);
+	f.push_back(type);
+	return f;
+}
+
+static Frame arp(word op, const byte * from_mac, const byte * from, const byte * target_mac, const byte * target, const byte * to_mac) {
+	Frame f = ether(to_mac, from_mac, 0x0806);
+	byte a[8] = { 0, 1, 8, 0, 6, 4, (byte)(op >> 8), (byte)op };
+	f.insert(f.end(), a, a + 8);
+	f.insert(f.end(), from_mac, from_mac + 6);
+	f.insert(f.end(), from, from + 4);
+	f.insert(f.end(), target_mac, target_mac + 6);
+	f.insert(f.end(), target, target + 4);
+	return f;
+}
+
+static Frame udp(const byte * from_mac, const byte * from, const byte * to, word sport, word dport, const char * payload) {
+	int n = strlen(payload);
+	Frame f = ether(eth.mac_address, from_mac, 0x0800);
+	byte h[28] = { 0x45, 0, (byte)((28 + n) >> 8), (byte)(28 + n), 0, 1, 0x40, 0, 64, 17 };
+	memcpy(h + 12, from, 4);
+	memcpy(h + 16, to, 4);
+	word c = checksum(h, 20, 0);
+	h[10] = c >> 8; h[11] = c;
+	h[20] = sport >> 8; h[21] = sport;
+	h[22] = dport >> 8; h[23] = dport;
+	h[24] = (8 + n) >> 8; h[25] = 8 + n;
+	f.insert(f.end(), h, h + 28);
+	f.insert(f.end(), payload, payload + n);
+	return f;
+}
+
+static void inject(Frame f) {
+	while(f.size() < 60) f.push_back(0);
+	chip.inject(&f[0], f.size());
+}
+
+static bool is_arp(const Frame & f, word op, const byte * target) {
+	return f.size() >= 42 && get16(f, 12) == 0x0806 && get16(f, 20) == op && !memcmp(&f[38], target, 4);
+}
+
+// answers every datagram with the same payload
+class Echo : public UDPSocket {
+  public:
+    NetStack * net;
+    int got;
+    char text[64];
+    Echo(NetStack * net, word port) : UDPSocket(port) {
+      this->net = net;
+      got = 0;
+      text[0] = 0;
+    }
+    void receive(ReadPage * data, word length) {
+      got++;
+      data->read(0, text, length);
+      text[length] = 0;
+      if(net->reply(this)) {
+        net->write(text, length);
+        net->send();
+      }
+    }
+};
+
+static void test_arp_reply(NetStack & net) {
+	chip.sent.clear();
+	inject(arp(1, host_mac, host, zero, me, ff));
+	check(net.poll() == 1, "ARP request polled");
+	check(chip.sent.size() == 1, "one ARP reply");
+	if(chip.sent.size() != 1) return;
+	Frame & r = chip.sent[0];
+	check(is_arp(r, 2, host) && !memcmp(&r[0], host_mac, 6) && !memcmp(&r[32], host_mac, 6), "ARP reply to the asker");
+	check(!memcmp(&r[22], eth.mac_address, 6) && !memcmp(&r[28], me, 4), "ARP reply says who we are");
+}
+
+static void test_send(NetStack & net) {
+	byte payload[400];
+	// odd and even lengths, with and without the DMA engine, and with it stuck
+	for(int mode=0; mode<3; mode++) {
+		net.dma_checksum = (mode != 1);
+		chip.dma_stuck = (mode == 2);
+		long runs = chip.dma_runs;
+		for(int n=0; n<300; n+=37) {
+			chip.sent.clear();
+			for(int i=0; i<n; i++) payload[i] = rand();
+			// (the host is known from its ARP request)
+			if(!net.begin(host, 5000, 6000)) { check(false, "begin to a known host"); return; }
+			net.write(payload, n / 3);
+			net.write(payload + n / 3, n - n / 3);
+			net.send();
+			check(chip.sent.size() == 1 && good_udp(chip.sent[0], host_mac, host, 5000, 6000, payload, n),
+				(mode == 0) ? "UDP with the DMA checksum" : (mode == 1) ? "UDP with the software checksum" : "UDP after the DMA engine timed out");
+		}
+		check((chip.dma_runs > runs) == (mode == 0), "DMA engine used when it should be");
+	}
+	chip.dma_stuck = false;
+	net.dma_checksum = true;
+}
+
+static void test_gateway(NetStack & net) {
+	chip.sent.clear();
+	check(!net.begin(far, 1, 2), "off-network send waits for the gateway");
+	check(chip.sent.size() == 1 && is_arp(chip.sent[0], 1, gw), "ARP for the gateway");
+	check(!net.begin(far, 1, 2) && chip.sent.size() == 1, "ARP requests rate limited");
+	inject(arp(2, gw_mac, gw, eth.mac_address, me, eth.mac_address));
+	net.poll();
+	// lots of senders from off the network, which all arrive through the gateway
+	for(int i=0; i<10; i++) {
+		byte from[4] = { 10, 0, 0, (byte)(1 + i) };
+		inject(udp(gw_mac, from, me, 1000, 9999, "far"));
+	}
+	net.poll();
+	chip.sent.clear();
+	check(net.begin(far, 1, 2), "gateway still known");
+	net.write('x');
+	net.send();
+	check(chip.sent.size() == 1 && good_udp(chip.sent[0], gw_mac, far, 1, 2, "x", 1), "off-network datagram to the gateway");
+	chip.sent.clear();
+	check(net.begin(host, 1, 2), "local host still known");
+	net.send();
+	chip.sent.clear();
+	check(net.begin(bc, 1, 2), "broadcast needs no ARP");
+	net.send();
+	check(chip.sent.size() == 1 && good_udp(chip.sent[0], ff, bc, 1, 2, 0, 0), "broadcast datagram");
+}
+
+static void test_arp_while_sending(NetStack & net) {
+	chip.sent.clear();
+	byte payload[100];
+	for(int i=0; i<100; i++) payload[i] = i;
+	check(net.begin(host, 5000, 6000), "begin");
+	net.write(payload, 50);
+	// a request comes in, and gets polled, half way through
+	inject(arp(1, other_mac, other, zero, me, ff));
+	net.poll();
+	check(chip.sent.size() == 0, "no ARP reply while a datagram is open");
+	net.write(payload + 50, 50);
+	net.send();
+	check(chip.sent.size() == 1 && good_udp(chip.sent[0], host_mac, host, 5000, 6000, payload, 100), "datagram intact");
+	net.poll();
+	check(chip.sent.size() == 2 && is_arp(chip.sent[1], 2, other) && !memcmp(&chip.sent[1][0], other_mac, 6), "ARP reply sent on the next poll");
+}
+
+static void test_sockets(NetStack & net) {
+	Echo echo(&net, 7);
+	net.bind(&echo);
+	chip.sent.clear();
+	word dropped = net.rx_dropped;
+	inject(udp(other_mac, other, me, 4444, 7, "hello there"));
+	inject(udp(other_mac, other, me, 4444, 9, "nobody"));
+	Frame bad = udp(other_mac, other, me, 4444, 7, "bad");
+	bad[24] ^= 1;
+	inject(bad);
+	check(net.poll() == 3, "three frames polled");
+	check(echo.got == 1 && !strcmp(echo.text, "hello there"), "datagram delivered");
+	check(chip.sent.size() == 1 && good_udp(chip.sent[0], other_mac, other, 7, 4444, "hello there", 11), "reply from receive()");
+	check(net.rx_dropped == dropped + 1, "bad IP checksum dropped");
+
+	// and through the interrupt driven receive
+	ENC28J60Packet pool[4];
+	HALQueue packets, spare;
+	for(int i=0; i<4; i++) { pool[i].next = 0; spare.enqueue(&pool[i]); }
+	eth.rx_queue(&packets, &spare);
+	chip.sent.clear();
+	int sent = 0;
+	for(int i=0; i<200; i++) {
+		char text[32];
+		snprintf(text, 32, "telemetry %d", i);
+		inject(udp(other_mac, other, me, 4444, 7, text));
+		if(chip.int_line()) eth.rx_interrupt();
+		net.poll(&packets);
+		if(strcmp(echo.text, text)) { check(false, "queued datagram delivered"); break; }
+		if(chip.sent.size() != 1 || !good_udp(chip.sent[0], other_mac, other, 7, 4444, text, strlen(text))) { check(false, "queued datagram answered"); break; }
+		chip.sent.clear();
+		sent++;
+	}
+	check(sent == 200, "every queued datagram");
+}
+
+int main(int argc, char ** argv) {
+	for(int i=0; i<HOST_PORTS; i++) fake_ports[i] = 0xFF;
+	chip.attach();
+	eth.start();
+	NetStack net(&eth, me);
+	memcpy(net.gateway, gw, 4);
+	test_arp_reply(net);
+	test_send(net);
+	test_gateway(net);
+	test_arp_while_sending(net);
+	test_sockets(net);
+	printf("tx %u rx %u dropped %u\n", net.tx_packets, net.rx_packets, net.rx_dropped);
+	if(failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  queue-sim : host-side check of the HALQueue algorithms under nested interrupts.
+
+  A desktop can't interrupt a function at an arbitrary instruction, so this is a model: the
+  enqueue, dequeue and dequeue_all steps of unorthodox_queues.h are copied out here one shared
+  memory access at a time, and between any two of them (except inside the masked tail swap)
+  an "interrupt" may fire and enqueue a node of its own. Interrupts nest up to MAX_DEPTH deep,
+  each level being a separate producer.
+
+  The main loop enqueues, dequeues one at a time, and takes batches with dequeue_all, at random.
+  At the end every node made must have come out exactly once, and each producer's nodes in the
+  order it made them.
+
+    g++ -O2 -o queue-sim queue-sim.cpp
+    ./queue-sim [seed]
+
+  If the queue code changes, change the model to match.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static const int MAX_DEPTH = 4;
+static const int PRODUCERS = MAX_DEPTH + 1; // the main loop, then each interrupt level
+static const long ITERATIONS = 1000000;
+
+struct Node {
+	Node * next;
+	int producer;
+	int seq;
+};
+
+// the queue is its own sentinel node, as in HALQueue
+struct Queue : Node {
+	Node * head;
+	Node * tail;
+} queue;
+
+static int depth = 0;
+static int deepest = 0;
+static long made = 0;
+static int seq[PRODUCERS];
+static std::vector<Node *> received;
+
+static void interrupt(int level);
+
+// a step boundary, where an interrupt may come in
+static void point() {
+	if((depth < MAX_DEPTH) && (rand() % 4 == 0)) interrupt(depth + 1);
+}
+
+static Node * make(int producer) {
+	Node * n = new Node();
+	n->next = 0;
+	n->producer = producer;
+	n->seq = seq[producer]++;
+	made++;
+	return n;
+}
+
+// hal_queue_enqueue
+static void enqueue(Node * first, Node * last) {
+	// the swap happens with interrupts masked, so no point() inside it
+	Node * prev = queue.tail;
+	queue.tail = last;
+	point();
+	prev->next = first;
+	point();
+}
+
+static void interrupt(int level) {
+	depth++;
+	if(depth > deepest) deepest = depth;
+	Node * n = make(level);
+	point();
+	enqueue(n, n);
+	depth--;
+}
+
+// hal_queue_dequeue
+static Node * dequeue() {
+	while(true) {
+		Node * head = queue.head;
+		point();
+		Node * next = head->next; // hal_link(), a single masked read
+		point();
+		if(next == 0) return 0;
+		queue.head = next;
+		point();
+		head->next = 0;
+		point();
+		if(head == &queue) {
+			enqueue(&queue, &queue);
+		} else {
+			return head;
+		}
+	}
+}
+
+// hal_queue_dequeue_all
+static Node * dequeue_all() {
+	Node * first = queue.head;
+	point();
+	if(first == &queue) {
+		first = queue.next;
+		point();
+		if(first == 0) return 0;
+		queue.next = 0;
+		point();
+		enqueue(&queue, &queue);
+	}
+	queue.head = &queue;
+	point();
+	return first;
+}
+
+// HALQueue::batch_next
+static Node * batch_next(Node * n) {
+	Node * link = n->next;
+	point();
+	n->next = 0;
+	return (link == &queue) ? 0 : link;
+}
+
+int main(int argc, char ** argv) {
+	srand((argc > 1) ? atoi(argv[1]) : 1);
+	queue.next = 0;
+	queue.head = &queue;
+	queue.tail = &queue;
+
+	for(long i = 0; i < ITERATIONS; i++) {
+		switch(rand() % 4) {
+		case 0: {
+			Node * n = make(0);
+			enqueue(n, n);
+			break;
+		}
+		case 1: {
+			Node * n = dequeue();
+			if(n) received.push_back(n);
+			break;
+		}
+		default:
+			for(Node * n = dequeue_all(); n; n = batch_next(n)) received.push_back(n);
+		}
+	}
+	// drain what's left, with no more interrupts
+	depth = MAX_DEPTH;
+	while(true) {
+		Node * n = dequeue_all();
+		if(n == 0) break;
+		for(; n; n = batch_next(n)) received.push_back(n);
+	}
+
+	int fails = 0;
+	if((long)received.size() != made) {
+		printf("FAIL: %ld nodes made, %ld received\n", made, (long)received.size());
+		fails++;
+	}
+	int last[PRODUCERS];
+	for(int p = 0; p < PRODUCERS; p++) last[p] = -1;
+	for(size_t i = 0; i < received.size(); i++) {
+		Node * n = received[i];
+		if(n == &queue) {
+			printf("FAIL: the sentinel was handed out\n");
+			return 1;
+		}
+		if(n->seq != last[n->producer] + 1) {
+			printf("FAIL: producer %d node %d came after %d\n", n->producer, n->seq, last[n->producer]);
+			fails++;
+		}
+		last[n->producer] = n->seq;
+	}
+	printf("%s: %ld nodes from %d producers, interrupts nested %d deep\n",
+		fails ? "FAILED" : "ok", made, PRODUCERS, deepest);
+	return fails;
+}
@@ -0,0 +1,127 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  scheduler-test : host-side check of the Scheduler's heap, filled right up.
+
+  A Scheduler of 200 is given 200 one-shot tasks at random delays, then taken through random
+  cancels, reschedules and periodic tasks. After every call the heap has to be a heap: each task
+  due no earlier than its parent, and each one knowing where it is. Then everything is made due
+  at once, and run() has to run each one-shot exactly once and leave only the periodic ones.
+  Last, a Scheduler asked for 255 has to stop at 254, since 255 means 'not scheduled'.
+
+  A heap that goes wrong may never finish a sift, so an alarm fails the test if it hangs.
+
+    g++ -O2 -I host -I ../arch/avr -o scheduler-test scheduler-test.cpp
+    ./scheduler-test [seed]
+ */
+
+#include <signal.h>
+#include <unistd.h>
+#include <Arduino.h>
+#include <unorthodox_queues.h>
+#include <unorthodox_tasks.h>
+
+Stream Serial;
+uint8_t SREG;
+
+static const int TASKS = 200;
+static int failures = 0;
+
+static void check(bool ok, const char * what) {
+	if(!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void hung(int) {
+	static const char message[] = "FAIL: the scheduler hung\n";
+	write(1, message, sizeof(message) - 1);
+	_exit(1);
+}
+
+class CountTask : public Task {
+public:
+	int ran;
+	CountTask() { ran = 0; }
+	void run(int) { ran++; }
+};
+
+static CountTask tasks[255];
+
+// is it a heap, and does every task know its place in it?
+static bool heap_ok(Scheduler & s) {
+	for(int i = 0; i < s.size(); i++) {
+		if(s.get(i)->heap_index != i) return false;
+		if(i > 0 && (long)(s.get(i)->due - s.get((i - 1) / 2)->due) < 0) return false;
+	}
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+	signal(SIGALRM, hung);
+	alarm(20);
+
+	Scheduler s(TASKS);
+	for(int i = 0; i < TASKS; i++) check(s.after(&tasks[i], 1000 + rand() % 60000), "after");
+	check(s.size() == TASKS, "full");
+	check(!s.after(&tasks[TASKS], 1000), "no room past capacity");
+	check(heap_ok(s), "heap after filling");
+
+	// churn it: cancel, reschedule, and make some periodic, keeping it near full
+	bool ok = true;
+	for(int n = 0; n < 200000 && ok; n++) {
+		CountTask * t = &tasks[rand() % TASKS];
+		int op = rand() % 4;
+		if(op == 0) s.cancel(t);
+		else if(op == 1) s.after(t, 1000 + rand() % 60000);
+		else if(op == 2) s.every(t, 1000 + rand() % 60000);
+		else if(!t->scheduled()) s.after(t, 1000 + rand() % 60000);
+		ok = heap_ok(s);
+	}
+	check(ok, "heap through cancels and reschedules");
+	int periodic = 0, one_shot = 0;
+	for(int i = 0; i < TASKS; i++) {
+		if(!tasks[i].scheduled()) continue;
+		if(tasks[i].period) periodic++; else one_shot++;
+	}
+	printf("%d scheduled, %d periodic\n", s.size(), periodic);
+	check(s.size() == periodic + one_shot, "size matches the scheduled tasks");
+
+	// make everything due now, and run it
+	for(int i = 0; i < TASKS; i++) {
+		if(!tasks[i].scheduled()) continue;
+		tasks[i].ran = 0;
+		if(tasks[i].period) s.every(&tasks[i], tasks[i].period, 0); else s.after(&tasks[i], 0);
+	}
+	check(heap_ok(s), "heap after making everything due");
+	s.run();
+	ok = true;
+	for(int i = 0; i < TASKS; i++) {
+		if(tasks[i].period && tasks[i].scheduled()) ok = ok && (tasks[i].ran == 1);
+		else ok = ok && (tasks[i].ran <= 1) && !tasks[i].scheduled();
+	}
+	check(ok, "everything due ran once");
+	check(s.size() == periodic, "only the periodic tasks left");
+	check(heap_ok(s), "heap after running");
+
+	// the capacity is clamped, so a heap_index never reads as 'not scheduled'
+	Scheduler big(255);
+	for(int i = 0; i < 255; i++) {
+		tasks[i].period = 0;
+		tasks[i].heap_index = Task::NOT_SCHEDULED;
+	}
+	int taken = 0;
+	for(int i = 0; i < 255; i++) if(big.after(&tasks[i], rand() % 60000)) taken++;
+	check(taken == 254, "capacity clamped to 254");
+	for(int n = 0; n < 20000; n++) big.cancel(&tasks[rand() % 254]), big.after(&tasks[rand() % 254], rand() % 60000);
+	check(heap_ok(big), "heap of 254");
+
+	if(failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
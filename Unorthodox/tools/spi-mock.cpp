@@ -0,0 +1,181 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  spi-mock : host-side check of SPIEngine and SPIDevice against a mock SPI bus.
+
+  The program stands in for the SPI hardware: whenever the engine has the SPI interrupt enabled
+  it takes the byte out of SPDR, records it along with whichever chip select is low, answers
+  with the byte inverted, and calls isr() as the interrupt would. The recorded wire traffic is
+  then checked against what was submitted:
+
+    - transfers run in submission order, each with only its own chip selected
+    - a null tx sends zeroes, a null rx drops the replies, a zero count sends nothing
+    - a transfer submitted from a done function runs after the ones already queued
+    - every chip is deselected, and the interrupt released, when the queue empties
+    - an SPIDevice can deselect() before it has ever select()ed
+
+  Then it times the engine's own cost per byte, over long transfers with no bus delay.
+
+    g++ -O2 -I host -I ../arch/avr -o spi-mock spi-mock.cpp
+    ./spi-mock
+ */
+
+#include <time.h>
+#include <vector>
+#include <Arduino.h>
+#include <SPI.h>
+#include <unorthodox_queues.h>
+#include <unorthodox_device.h>
+
+Stream Serial;
+uint8_t SREG;
+volatile uint8_t SPCR, SPDR, SPSR;
+volatile uint8_t fake_ports[HOST_PORTS];
+SPIClass SPI;
+
+static SPIEngine engine;
+static int failures = 0;
+
+static void check(bool ok, const char * what) {
+	if(!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+// which chip select pin is low, or -1 for none (or -2 for more than one)
+static int selected() {
+	int found = -1;
+	for(int pin = 0; pin < HOST_PORTS * 8; pin++) {
+		if(!(fake_ports[pin / 8] & (1 << (pin % 8)))) found = (found == -1) ? pin : -2;
+	}
+	return found;
+}
+
+// one byte on the wire
+struct WireByte {
+	int chip;
+	byte b;
+};
+static std::vector<WireByte> wire;
+
+// run the bus until the engine goes idle
+static void run_bus() {
+	while(!engine.idle()) {
+		if(!(SPCR & (1 << SPIE))) {
+			check(false, "engine busy with the interrupt off");
+			return;
+		}
+		WireByte w = { selected(), SPDR };
+		wire.push_back(w);
+		SPDR = w.b ^ 0xFF;
+		engine.isr();
+	}
+}
+
+// completion order, by context number. transfer 1's done function submits another.
+static std::vector<long> completed;
+static SPITransfer extra;
+static byte extra_tx[3] = { 7, 8, 9 };
+
+static void done(SPITransfer * t) {
+	completed.push_back((long)t->context);
+	if(((long)t->context == 1) && !extra.busy) {
+		extra.set_chip(20);
+		extra.set(extra_tx, 0, 3);
+		extra.context = (void *)99;
+		extra.done = done;
+		engine.submit(&extra);
+	}
+}
+
+static void test_engine() {
+	SPITransfer t[5];
+	byte tx[5][4];
+	byte rx[5][4];
+	memset(rx, 0, sizeof(rx));
+	for(int i = 0; i < 5; i++) {
+		for(int j = 0; j < 4; j++) tx[i][j] = i * 16 + j;
+		// 2 drops its replies, 3 sends zeroes, 4 sends nothing at all
+		t[i].set_chip(8 + i);
+		t[i].set((i == 3) ? 0 : tx[i], (i == 2) ? 0 : rx[i], (i == 4) ? 0 : i + 1);
+		t[i].done = done;
+		t[i].context = (void *)(long)i;
+	}
+	for(int i = 0; i < 5; i++) check(engine.submit(&t[i]), "submit");
+	check(!engine.submit(&t[1]), "a busy transfer can't be submitted again");
+	run_bus();
+
+	check(!(SPCR & (1 << SPIE)), "interrupt released when idle");
+	check(selected() == -1, "all chips deselected when idle");
+	size_t k = 0;
+	for(int i = 0; i < 5; i++) {
+		int count = (i == 4) ? 0 : i + 1;
+		for(int j = 0; j < count; j++, k++) {
+			check((k < wire.size()) && (wire[k].chip == 8 + i), "transfer order and chip select");
+			check((k < wire.size()) && (wire[k].b == ((i == 3) ? 0 : tx[i][j])), "bytes sent");
+		}
+	}
+	for(int j = 0; j < 3; j++, k++) {
+		check((k < wire.size()) && (wire[k].chip == 20) && (wire[k].b == extra_tx[j]), "transfer submitted from done");
+	}
+	check(k == wire.size(), "no stray bytes");
+	for(int i = 0; i < 4; i++) {
+		if(i == 2) continue;
+		for(int j = 0; j <= i; j++) check(rx[i][j] == (byte)(((i == 3) ? 0 : tx[i][j]) ^ 0xFF), "bytes received");
+	}
+	long order[] = { 0, 1, 2, 3, 4, 99 };
+	check(completed.size() == 6, "every transfer completed");
+	for(size_t i = 0; (i < completed.size()) && (i < 6); i++) check(completed[i] == order[i], "completion order");
+	for(int i = 0; i < 5; i++) check(!t[i].busy, "transfers released");
+}
+
+// an SPIDevice which lets us drive its chip select
+class TestDevice : public SPIDevice {
+public:
+	TestDevice(int pin) { chip_select = pin; }
+	void up() { deselect(); }
+	void down() { select(); }
+};
+
+static void test_device() {
+	memset((void *)fake_ports, 0, sizeof(fake_ports));
+	TestDevice device(13);
+	device.up();
+	check(fake_ports[1] & (1 << 5), "deselect() before any select()");
+	device.down();
+	check(!(fake_ports[1] & (1 << 5)), "select()");
+	device.up();
+	check(fake_ports[1] & (1 << 5), "deselect()");
+}
+
+static void bench_engine() {
+	static byte buffer[1024];
+	SPITransfer t;
+	t.set_chip(8);
+	t.set(buffer, buffer, sizeof(buffer));
+	long bytes = 0;
+	timespec a, b;
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	for(int i = 0; i < 20000; i++) {
+		engine.submit(&t);
+		while(!engine.idle()) {
+			SPDR = ~SPDR;
+			engine.isr();
+			bytes++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	double seconds = (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) * 1e-9;
+	printf("engine: %.1f ns per byte (isr() plus queue handling, on this host)\n", seconds / bytes * 1e9);
+}
+
+int main() {
+	memset((void *)fake_ports, 0xFF, sizeof(fake_ports));
+	test_engine();
+	test_device();
+	memset((void *)fake_ports, 0xFF, sizeof(fake_ports));
+	bench_engine();
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures;
+}
@@ -0,0 +1,86 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  tokenfs-bench : host-side comparison of HashTokenFS against the dense TokenFS index - RAM
+  taken by the index, and the cost of a token_size() lookup that hits and one that misses.
+
+  Build and run it on the desktop, not the Arduino:
+
+    g++ -O2 -I host -I ../arch/avr -o tokenfs-bench tokenfs-bench.cpp
+    ./tokenfs-bench
+
+  The index sizes are the same as on the Leonardo (both tables are made of 16-bit words). The
+  times are the host's, and only mean anything relative to each other. Storage is a 2K
+  MemoryPage, with five bytes of payload per token.
+ */
+
+#include <time.h>
+#include <Arduino.h>
+#include <unorthodox_page.h>
+
+Stream Serial;
+uint8_t SREG;
+
+static const int LOOKUPS = 10000000;
+static const word DENSE_IDS = 192;
+
+static byte storage[2048];
+static volatile word sink;
+
+static double now() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// ns per token_size() call, over 'live' ids spaced 'step' apart, offset by 'miss'
+template <class FS> static double time_lookup(FS & fs, int live, word step, word miss) {
+	double a = now();
+	for(int i = 0; i < LOOKUPS; i++) sink += fs.token_size((i % live) * step + miss);
+	return (now() - a) / LOOKUPS * 1e9;
+}
+
+static void bench(int live) {
+	MemoryPage store(storage);
+	printf("%d live tokens:\n", live);
+
+	// dense ids 0..live-1, out of a table for DENSE_IDS. A miss is the next id up.
+	{
+		memset(storage, 0, sizeof(storage));
+		TokenFS fs(&store, sizeof(storage), DENSE_IDS);
+		fs.start();
+		for(int i = 0; i < live; i++) {
+			byte d[6] = {(byte)i, 1, 2, 3, 4, 5};
+			MemoryPage source(d);
+			fs.token_write(i, &source, 6);
+		}
+		double hit = time_lookup(fs, live, 1, 0);
+		double miss = time_lookup(fs, live, 1, live);
+		printf("  TokenFS (%d ids)     index %4d bytes   hit %5.1f ns   miss %5.1f ns\n",
+			DENSE_IDS, (int)(DENSE_IDS * sizeof(word)), hit, miss);
+	}
+
+	// ids scattered over 16 bits. A miss is one off a live id, so it lands in the same runs.
+	for(byte load = 50; load <= 90; load += 20) {
+		memset(storage, 0, sizeof(storage));
+		HashTokenFS fs(&store, sizeof(storage), 2, load);
+		fs.start();
+		for(int i = 0; i < live; i++) {
+			word id = i * 1237;
+			byte d[6] = {(byte)id, (byte)(id >> 8), 1, 2, 3, 4};
+			MemoryPage source(d);
+			fs.token_write(id, &source, 6);
+		}
+		double hit = time_lookup(fs, live, 1237, 0);
+		double miss = time_lookup(fs, live, 1237, 1);
+		printf("  HashTokenFS (%d%%)     index %4d bytes   hit %5.1f ns   miss %5.1f ns   (%d%% full)\n",
+			load, fs.index_memory(), hit, miss, (int)(fs.live * 100 * sizeof(HashToken) / fs.index_memory()));
+	}
+}
+
+int main() {
+	bench(16);
+	bench(40);
+	bench(96);
+	return 0;
+}
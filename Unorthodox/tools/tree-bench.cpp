@@ -0,0 +1,183 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  tree-bench : host-side timing of the red-black tree algorithms, reached through virtual
+  accessors (RedBlackTree) and through inline ones (RedBlackCore), at 100, 1000 and 10000 nodes.
+
+  Both trees keep their nodes in the same index-linked array, so the only difference between
+  them is how RedBlackCore gets at a link - a virtual call, or an inlined array access. Map is
+  timed alongside as the pointer-linked case, both directly and through the MapTree adapter,
+  which puts the virtual calls back.
+
+  Build and run it on the desktop, not the Arduino:
+
+    g++ -O2 -DHOST_WIDE_WORD -I host -I ../arch/avr -o tree-bench tree-bench.cpp
+    ./tree-bench
+
+  (HOST_WIDE_WORD because Map keeps pointers in word links.) On the 32U4 the gap should be
+  wider still, since a virtual call there is a vtable load and an icall per link.
+ */
+
+#include <Arduino.h>
+#include <bench.h>
+#include <unorthodox_page.h>
+#include <unorthodox_trees.h>
+
+Stream Serial;
+uint8_t SREG;
+
+// an index-linked node table, which both test trees are laid over
+struct BenchNode {
+	word parent;
+	word left;
+	word right;
+	word meta;
+};
+
+struct BenchTable {
+	BenchNode * nodes;
+	word root;
+	BenchTable(word count) { nodes = new BenchNode[count + 1]; root = 0; }
+	~BenchTable() { delete[] nodes; }
+};
+
+// every accessor through the vtable
+class VirtualTree : public RedBlackTree {
+	BenchTable table;
+	word parent(word node) { return table.nodes[node].parent; }
+	word left(word node) { return table.nodes[node].left; }
+	word right(word node) { return table.nodes[node].right; }
+	bool is_red(word node) { return (table.nodes[node].meta & 0x8000)!=0; }
+	void set_parent(word node, word link) { table.nodes[node].parent = link; }
+	void set_left(word node, word link) { table.nodes[node].left = link; }
+	void set_right(word node, word link) { table.nodes[node].right = link; }
+	void set_red(word node) { table.nodes[node].meta |= 0x8000; }
+	void set_black(word node) { table.nodes[node].meta &= 0x7FFF; }
+	word tree_root() { return table.root; }
+	void set_root(word node) { table.root = node; }
+	int node_compare(word lnode, word rnode) { return (int)(table.nodes[lnode].meta & 0x7FFF) - (int)(table.nodes[rnode].meta & 0x7FFF); }
+	int key_compare(word lnode, word rkey) { return (int)(table.nodes[lnode].meta & 0x7FFF) - (int)rkey; }
+public:
+	VirtualTree(word count) : table(count) { }
+	void node_print(int indent, word node) { }
+	void set_key(word node, word key) { table.nodes[node].meta = key; }
+};
+
+// the same accessors, inlined into the algorithms
+class InlineTree : public RedBlackCore<InlineTree> {
+	friend class RedBlackCore<InlineTree>;
+	BenchTable table;
+	word parent(word node) { return table.nodes[node].parent; }
+	word left(word node) { return table.nodes[node].left; }
+	word right(word node) { return table.nodes[node].right; }
+	bool is_red(word node) { return (table.nodes[node].meta & 0x8000)!=0; }
+	void set_parent(word node, word link) { table.nodes[node].parent = link; }
+	void set_left(word node, word link) { table.nodes[node].left = link; }
+	void set_right(word node, word link) { table.nodes[node].right = link; }
+	void set_red(word node) { table.nodes[node].meta |= 0x8000; }
+	void set_black(word node) { table.nodes[node].meta &= 0x7FFF; }
+	word tree_root() { return table.root; }
+	void set_root(word node) { table.root = node; }
+	int node_compare(word lnode, word rnode) { return (int)(table.nodes[lnode].meta & 0x7FFF) - (int)(table.nodes[rnode].meta & 0x7FFF); }
+	int key_compare(word lnode, word rkey) { return (int)(table.nodes[lnode].meta & 0x7FFF) - (int)rkey; }
+	void node_print(int indent, word node) { }
+public:
+	InlineTree(word count) : table(count) { }
+	void set_key(word node, word key) { table.nodes[node].meta = key; }
+};
+
+// node n holds keys[n-1]. seeks and removes go in a different order to the inserts.
+template <class Tree> static void time_tree(word * keys, int count, int reps, Timing & t) {
+	for(int r = 0; r < reps; r++) {
+		Tree tree(count);
+		double a = now();
+		for(int i = 1; i <= count; i++) {
+			tree.set_key(i, keys[i-1]);
+			sink = tree.tree_insert_node(i);
+		}
+		double b = now();
+		for(int i = 0; i < count; i++) sink = tree.tree_seek_node(keys[(i * 7) % count], Tree::MATCH_EXACT);
+		double c = now();
+		for(int i = 0; i < count; i++) tree.tree_remove_node((i * 13) % count + 1);
+		double d = now();
+		t.add(a, b, c, d);
+	}
+}
+
+static void time_map(word * keys, int count, int reps, Timing & t) {
+	for(int r = 0; r < reps; r++) {
+		MapPool pool(sizeof(MapNode), count);
+		Map map(&pool);
+		double a = now();
+		for(int i = 0; i < count; i++) sink = (word)map.insert(keys[i]);
+		double b = now();
+		for(int i = 0; i < count; i++) sink = (word)map.seek(keys[(i * 7) % count]);
+		double c = now();
+		for(int i = 0; i < count; i++) sink = map.erase(keys[(i * 13) % count]);
+		double d = now();
+		t.add(a, b, c, d);
+	}
+}
+
+// the same Map, driven through the virtual MapTree adapter
+static void time_map_tree(word * keys, int count, int reps, Timing & t) {
+	for(int r = 0; r < reps; r++) {
+		MapPool pool(sizeof(MapNode), count);
+		Map map(&pool);
+		MapTree tree(&map);
+		double a = now();
+		for(int i = 0; i < count; i++) {
+			MapNode * node = pool.alloc();
+			node->set_key(keys[i]);
+			sink = tree.tree_insert_node((word)node);
+		}
+		double b = now();
+		for(int i = 0; i < count; i++) sink = tree.tree_seek_node(keys[(i * 7) % count], RedBlackTree::MATCH_EXACT);
+		double c = now();
+		for(int i = 0; i < count; i++) {
+			word node = tree.tree_seek_node(keys[(i * 13) % count], RedBlackTree::MATCH_EXACT);
+			tree.tree_remove_node(node);
+			pool.free((MapNode *)node);
+		}
+		double d = now();
+		t.add(a, b, c, d);
+	}
+}
+
+static void report(const char * name, long ops, Timing & t) {
+	printf("  %-28s insert %6.2f  seek %6.2f  remove %6.2f  M/s\n",
+		name, ops / t.insert / 1e6, ops / t.seek / 1e6, ops / t.remove / 1e6);
+}
+
+static void bench(int count) {
+	// distinct keys in random order. 7 and 13 are coprime to every count used, so the
+	// seek and remove orders visit each key once.
+	static word keys[32768];
+	shuffle_keys(keys, 32768);
+	int reps = 1000000 / count;
+	long ops = (long)count * reps;
+
+	// interleave the rounds, so any slow patch on the host hits every tree alike
+	Timing virt, inl, map, map_tree;
+	for(int round = 0; round < BENCH_ROUNDS; round++) {
+		Timing t1, t2, t3, t4;
+		time_tree<VirtualTree>(keys, count, reps, t1); virt.best(t1);
+		time_tree<InlineTree>(keys, count, reps, t2); inl.best(t2);
+		time_map(keys, count, reps, t3); map.best(t3);
+		time_map_tree(keys, count, reps, t4); map_tree.best(t4);
+	}
+
+	printf("%d nodes:\n", count);
+	report("RedBlackTree (virtual)", ops, virt);
+	report("RedBlackCore (inline)", ops, inl);
+	report("Map (pooled, pointer links)", ops, map);
+	report("MapTree (virtual, same Map)", ops, map_tree);
+}
+
+int main() {
+	srand(1);
+	bench(100);
+	bench(1000);
+	bench(10000);
+	return 0;
+}
@@ -0,0 +1,251 @@
+/*
+  nano operating system for the Arduino (Leonardo)  (c) Jeremy Lee 2013
+
+  twi-mock : host-side check of TWIEngine against a mock TWI unit and bus.
+
+  The program stands in for the TWI hardware (through host/twi.h) and two register-file devices,
+  an MPU6050 at 0x68 and an HMC5883L at 0x1E. Each TWCR write is turned into the bus event it
+  asks for, written down in a trace, and answered with the status code and interrupt the real
+  unit would give:
+
+    S  start          Sr  repeated start     P  stop
+    Wxx / Rxx  address for write / read      [xx]  data byte written
+    a / n  data byte read, acknowledged / not
+
+  A lone STOP takes a few more reads of TWCR to go out, as on the real bus, and starting again
+  before it has is a failure. Checked:
+
+    - a burst read, a register write, a missing device and a single byte read, back to back
+    - the interrupt never waits for a STOP: a queued transaction's START goes out with it
+    - submit() on an engine that has only just gone idle waits for the STOP itself
+    - a transaction submitted from a done function runs after the ones already queued
+    - a bus error fails its transaction, and the next one still runs
+
+    g++ -O2 -I host -I ../arch/avr -o twi-mock twi-mock.cpp
+    ./twi-mock
+ */
+
+#include <string>
+#include <Arduino.h>
+#include <twi.h>
+#include <unorthodox_queues.h>
+#include <unorthodox_device.h>
+#include <unorthodox_drivers_i2c.h>
+
+Stream Serial;
+uint8_t SREG;
+uint8_t TWSR, TWDR, TWBR;
+HostTWCR host_twcr;
+
+static TWIEngine twi;
+static int failures = 0;
+
+static void check(bool ok, const char * what) {
+	if(!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+// the bus
+static std::string trace;
+static bool irq = false;         // TWINT, waiting for the interrupt
+static bool in_isr = false;
+static int phase = 0;            // 0 idle, 1 after a start, 2 writing, 3 reading
+static int device = -1;
+static bool first;               // the first byte written is the register pointer
+static byte regs[2][128];
+static int pointer[2];
+static int stop_left = 0;        // TWCR reads until a lone STOP has gone out
+static int isr_stop_polls = 0;   // TWSTO polled from inside the interrupt
+static int submit_stop_polls = 0;
+static bool bus_error = false;   // fail the next data byte with a bus error
+static bool errored = false;
+
+static int device_index(int a) { return (a == 0x68) ? 0 : (a == 0x1E) ? 1 : -1; }
+
+static void event(const char * text) { trace += text; trace += " "; }
+
+static uint8_t twcr_read() {
+	if(host_twcr.value & (1<<TWSTO)) {
+		if(in_isr) isr_stop_polls++; else submit_stop_polls++;
+		if(--stop_left <= 0) host_twcr.value &= ~(1<<TWSTO);
+	}
+	return host_twcr.value;
+}
+
+static void twcr_written(uint8_t x) {
+	bool stopping = host_twcr.value & (1<<TWSTO);
+	host_twcr.value = (x & ~((1<<TWINT) | (1<<TWSTO) | (1<<TWSTA))) | (stopping ? (1<<TWSTO) : 0);
+	if(!(x & (1<<TWINT))) return;
+	char t[8];
+	if(errored) {
+		// the only way out of a bus error
+		check(x == ((1<<TWINT) | (1<<TWEN) | (1<<TWSTO)), "bus error cleared with TWSTO");
+		event("reset");
+		errored = false;
+		phase = 0;
+		return;
+	}
+	if((x & (1<<TWSTA)) && stopping) check(false, "START while a STOP was still going out");
+	if(x & (1<<TWSTO)) {
+		event("P");
+		phase = 0;
+		if(!(x & (1<<TWSTA))) {
+			host_twcr.value |= (1<<TWSTO);
+			stop_left = 3;
+			return;
+		}
+	}
+	if(x & (1<<TWSTA)) {
+		event(phase ? "Sr" : "S");
+		TWSR = phase ? 0x10 : 0x08;
+		phase = 1;
+		irq = true;
+		return;
+	}
+	if(phase == 0) {
+		check(false, "bus event with no START");
+		return;
+	}
+	if(bus_error) {
+		bus_error = false;
+		errored = true;
+		TWSR = 0x00;
+		irq = true;
+		return;
+	}
+	if(phase == 1) {
+		int a = TWDR >> 1;
+		bool r = TWDR & 1;
+		snprintf(t, 8, "%c%02x", r ? 'R' : 'W', a);
+		event(t);
+		device = device_index(a);
+		if(device < 0) TWSR = r ? 0x48 : 0x20;
+		else {
+			TWSR = r ? 0x40 : 0x18;
+			phase = r ? 3 : 2;
+			first = true;
+		}
+		irq = true;
+		return;
+	}
+	if(phase == 2) {
+		snprintf(t, 8, "[%02x]", TWDR);
+		event(t);
+		if(first) { pointer[device] = TWDR; first = false; }
+		else regs[device][pointer[device]++ & 127] = TWDR;
+		TWSR = 0x28;
+		irq = true;
+		return;
+	}
+	TWDR = regs[device][pointer[device]++ & 127];
+	bool ack = x & (1<<TWEA);
+	event(ack ? "a" : "n");
+	TWSR = ack ? 0x50 : 0x58;
+	irq = true;
+}
+
+// run interrupts until the engine lets go of them
+static void run_bus() {
+	while(irq && (host_twcr.value & (1<<TWIE))) {
+		irq = false;
+		in_isr = true;
+		twi.isr();
+		in_isr = false;
+	}
+}
+
+static int chained = 0;
+static TWITransaction chain;
+static void on_done(TWITransaction * t) {
+	chained++;
+	if(chained < 3) twi.submit(&chain);
+}
+
+int main() {
+	for(int i=0; i<128; i++) {
+		regs[0][i] = i * 3;
+		regs[1][i] = 200 - i;
+	}
+	host_twcr.written = twcr_written;
+	host_twcr.read = twcr_read;
+	twi.start(400000);
+	check(TWBR == 12, "400kHz bit rate");
+
+	// one burst read
+	MPU6050Reading imu;
+	check(twi.submit(&imu), "submit");
+	check(!twi.submit(&imu), "submit while busy refused");
+	run_bus();
+	printf("%s\n", trace.c_str());
+	check(trace == "S W68 [3b] Sr R68 a a a a a a a a a a a a a n P ", "burst read trace");
+	check(!imu.busy && imu.error == 0 && twi.idle(), "burst read finished");
+	int a[3], g[3], temp;
+	imu.accel_vector(a);
+	imu.gyro_vector(g);
+	imu.temp_vector(&temp);
+	bool same = (temp == (((0x41 * 3) & 255) << 8 | ((0x42 * 3) & 255)));
+	for(int i=0; i<3; i++) {
+		same = same && (a[i] == (((0x3B + 2*i) * 3 & 255) << 8 | ((0x3C + 2*i) * 3 & 255)));
+		same = same && (g[i] == (((0x43 + 2*i) * 3 & 255) << 8 | ((0x44 + 2*i) * 3 & 255)));
+	}
+	check(same, "burst read data");
+
+	// back to back: a compass read, a write, a missing device and a single byte read.
+	// (the engine went idle with a STOP going out, so the first submit waits for it)
+	trace = "";
+	HMC5883LReading mag;
+	TWITransaction w, missing, one;
+	byte b1;
+	w.set_write(0x68, 0x6B, 0x03);
+	missing.set_read(0x50, 0, &b1, 1);
+	one.set_read(0x68, 0x75, &b1, 1);
+	twi.submit(&mag);
+	twi.submit(&w);
+	twi.submit(&missing);
+	twi.submit(&one);
+	run_bus();
+	printf("%s\n", trace.c_str());
+	check(trace == "S W1e [03] Sr R1e a a a a a n P S W68 [6b] [03] P S W50 P S W68 [75] Sr R68 n P ", "queued trace");
+	check(regs[0][0x6B] == 3, "register written");
+	check(missing.error == 0x20, "missing device reported");
+	check(mag.error == 0 && one.error == 0 && b1 == (0x75 * 3 & 255), "reads after the missing device");
+	int m[3];
+	mag.get_vector(m);
+	check(m[0] == ((200 - 3) << 8 | (200 - 4)), "compass data");
+	check(submit_stop_polls > 0, "submit waited for the last STOP");
+	check(isr_stop_polls == 0, "interrupt never waited for a STOP");
+
+	// resubmitted from the done function
+	trace = "";
+	chain.set_read(0x1E, 0x0A, &b1, 1);
+	chain.done = on_done;
+	twi.submit(&chain);
+	run_bus();
+	printf("%s\n", trace.c_str());
+	check(chained == 3 && twi.idle(), "resubmitted from done");
+	check(trace == "S W1e [0a] Sr R1e n P S W1e [0a] Sr R1e n P S W1e [0a] Sr R1e n P ", "resubmitted trace");
+
+	// a bus error part way through, with another transaction queued behind it
+	trace = "";
+	TWITransaction broken;
+	broken.set_read(0x68, 0x10, &b1, 1);
+	bus_error = true;
+	twi.submit(&broken);
+	twi.submit(&one);
+	run_bus();
+	printf("%s\n", trace.c_str());
+	check(broken.error == 0xFF, "bus error reported");
+	check(one.error == 0 && b1 == (0x75 * 3 & 255), "next transaction after a bus error");
+	check(trace == "S reset S W68 [75] Sr R68 n P ", "bus error trace");
+	check(isr_stop_polls == 0, "interrupt never waited for a STOP");
+	check(twi.idle() && !irq, "engine idle");
+
+	if(failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}